@@ -39,6 +39,18 @@
 /// Type for equality operator is: int (*equal_operator) (const T, const T)
 #  define EQ_OPERATOR_TYPE(T)                       EQ_##T##_TYPE
 
+/// Type for less than operator is: int (*less_than_operator) (const T, const T)
+#  define LT_OPERATOR_TYPE(T)                       LT_##T##_TYPE
+
+/// Type for hash operator is: size_t (*hash_operator) (const T)
+#  define HASH_OPERATOR_TYPE(T)                     HASH_##T##_TYPE
+
+/// Type for normalizer is: T (*normalizer) (const T)
+#  define NORMALIZER_TYPE(T)                        NORM_##T##_TYPE
+
+/// Type for word operator is: int (*word_operator) (const T)
+#  define WORD_OPERATOR_TYPE(T)                     WORD_##T##_TYPE
+
 /// SET_DESTRUCTOR optionally declares a destructor for type T.
 /// Example: SET_DESTRUCTOR (mytype, mydestructor);
 #  define SET_DESTRUCTOR(T, destructor)             do { DESTROY_##T = (destructor) ; } while (0)
@@ -54,18 +66,64 @@
 ///          SET_EQ_OPERATOR (wchar_t, nocaseeq);
 #  define SET_EQ_OPERATOR(T, equal_operator)        do { EQ_##T = (equal_operator) ; } while (0)
 
+/// SET_LT_OPERATOR optionally declares an ordering (less than) operator for type T.
+/// If declared, the symbols following each state are kept sorted and searched by binary search rather than linearly,
+/// which is faster for states followed by many symbols.
+/// The ordering must be a strict weak ordering whose equivalence classes are those of the equality operator:
+/// !lt (a, b) && !lt (b, a) if and only if eq (a, b).
+/// Equality is still checked with the equality operator, on the symbol found by binary search only:
+/// with a mismatched pair (e.g. a case insensitive equality and a bytewise ordering), transitions are missed.
+/// Example of a consistent pair: eq (a, b) { return towlower (a) == towlower (b); } and lt (a, b) { return towlower (a) < towlower (b); }
+/// Note: SET_LT_OPERATOR must be called before the creation of the machines it applies to.
+/// Example: static int lt (wchar_t a, wchar_t b) { return a < b; }
+///          SET_LT_OPERATOR (wchar_t, lt);
+#  define SET_LT_OPERATOR(T, less_than_operator)    do { LT_##T = (less_than_operator) ; } while (0)
+
+/// SET_HASH_OPERATOR optionally declares a hash operator for type T.
+/// The symbols following a state with many transitions (at least ACM_HASH_MIN_FANOUT) are then also indexed by a hash table,
+/// and found in constant expected time rather than by a linear or binary search.
+/// The hash operator must be consistent with the equality operator: hash (a) == hash (b) if eq (a, b) is true.
+/// A default hash operator (of the bytes of the symbols) is used for symbols compared by the default equality operator.
+/// Note: SET_HASH_OPERATOR must be called before the creation of the machines it applies to.
+/// Example: typedef char *string;  // ACM_DECLARE (string) and ACM_DEFINE (string)
+///          static size_t hash (string s) { size_t h = 5381; while (*s) h = 33 * h + (unsigned char) *s++; return h; }
+///          SET_HASH_OPERATOR (string, hash);
+#  define SET_HASH_OPERATOR(T, hash_operator)       do { HASH_##T = (hash_operator) ; } while (0)
+
+/// SET_NORMALIZER optionally declares a normalizer for type T, applied once to each symbol of keywords and texts
+/// (for instance a case folding), so that symbols are then compared with the default equality operator.
+/// It replaces an equality operator such as nocaseeq, called for each transition compared, by one call per symbol.
+/// The normalizer must return a symbol which does not need to be destroyed (it is copied by the copy constructor).
+/// Note: SET_NORMALIZER must be called before the creation of the machines it applies to,
+///       and machines loaded by ACM_load_mapped must be created with the normalizer of the saved machine
+///       (a file saved with a normalizer is not loaded without one, and conversely).
+/// Example: static wchar_t fold (wchar_t c) { return towlower (c); }
+///          SET_NORMALIZER (wchar_t, fold);
+#  define SET_NORMALIZER(T, normalizer)             do { NORM_##T = (normalizer) ; } while (0)
+
+/// SET_WORD_OPERATOR optionally declares a predicate telling whether a symbol of type T is part of a word,
+/// for whole word matching (see ACM_MATCH_WORDS in ACM_match_records).
+/// It is only applied to the symbols of texts around the matches: keywords need not be padded with separators,
+/// and neither the symbols stored in the machine nor their comparisons are changed.
+/// Note: SET_WORD_OPERATOR must be called before the creation of the machines it applies to.
+/// Example: static int isword (wchar_t c) { return iswalpha (c); }
+///          SET_WORD_OPERATOR (wchar_t, isword);
+#  define SET_WORD_OPERATOR(T, word_operator)       do { WORD_##T = (word_operator) ; } while (0)
+
 /// ACState (T) is the type of a Aho-Corasick state machine for type T
 #  define ACState(T)                                ACState_##T
 
 /// ACMachine (T) is the type of the Aho-Corasick finite state machine for type T
 #  define ACMachine(T)                              ACMachine_##T
 
-/// ACMachine (T) *ACM_create (T, [equality_operator], [copy constructor], [destructor])
+/// ACMachine (T) *ACM_create (T, [equality_operator], [copy constructor, destructor], [less_than_operator])
 /// Creates a Aho-Corasick finite state machine for type T.
 /// @param [in] T type of symbols composing keywords and text to be parsed.
 /// @param [in, optional] equality_operator Equality operator of type EQ_OPERATOR_TYPE(T).
 /// @param [in, optional] copy constructor Copy constructor of type COPY_CONSTRUCTOR_TYPE(T).
 /// @param [in, optional] destructor Destructor of type DESTRUCTOR_TYPE(T).
+/// @param [in, optional] less_than_operator Ordering operator of type LT_OPERATOR_TYPE(T) (see SET_LT_OPERATOR),
+///                                          a strict weak ordering whose equivalent symbols are the ones equal for equality_operator.
 /// @returns A pointer to a Aho-Corasick machine for type T.
 /// Example: ACMachine (char) * M = ACM_create (char);
 /// Note: ACM_create accepts optional arguments thanks to the use of the VFUNC macro (see below).
@@ -74,6 +132,7 @@
 /// void ACM_release (const ACMachine (T) *machine)
 /// Releases the ressources of a Aho-Corasick machine created with ACM_create.
 /// @param [in] machine A pointer to a Aho-Corasick machine to be realeased.
+/// Note: A snapshot returned by ACM_snapshot is released by its reader with ACM_release as well.
 /// Example: ACM_release (M);
 #  define ACM_release(machine)                      (machine)->vtable->release ((machine))
 
@@ -99,7 +158,7 @@
 ///                                  The default destructor is the standard library function `free.
 ///                                  Use `0` if the allocated value need not be managed by the finite state machine
 ///                                  (in case of automatic or static values).
-/// @return 1 if the keyword was successfully registered, 0 otherwise (if the keyword is empty).
+/// @return 1 if the keyword was successfully registered, 0 otherwise (if the keyword is empty or the machine is frozen by ACM_build).
 /// Note: When returning 0, the destructor, if any, is called on value, if any.
 /// Note: If the keywpord is already registered in the machine, its associated value is forgotten and replaced by the new value.
 /// Note: Keyword kw is duplicated and can be released after its registration.
@@ -108,10 +167,29 @@
 ///       The rank of the registered keyword is the number of times ACM_register_keyword was previously called
 ///       since the machine was created. The rank is a 0-based sequence number.
 ///       This rank can later be retrieved by ACM_get_match.
+/// Note: Once the failure function has been constructed, it is updated in place. For each new state s = g(r, a),
+///       the states failing to r or below are searched for a transition on a, down to the first one found on each branch.
+///       A new transition from state 0 thereby visits nearly every state of the machine (O(size of the machine)),
+///       while deeper new states only visit the states failing to their parent. The output of a new keyword is added
+///       to every state whose chain of failure states reaches it (all the states ending with the keyword).
 /// Example: ACM_register_keyword (M, kw);
 ///          ACM_register_keyword (M, kw, calloc (1, sizeof (int)), free);
 #  define ACM_register_keyword(...)                 VFUNC(ACM_register_keyword, __VA_ARGS__)
 
+/// size_t ACM_register_keywords(ACMachine(T) *machine, const Keyword(T) *kws, size_t nb_keywords, [void ** value_ptrs], [void (*destructor) (void *)])
+/// Registers a set of keywords in the Aho-Corasick machine, and builds its failure function once for all.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @param [in] kws Array of nb_keywords keywords of symbols of type T to be registered.
+/// @param [in] nb_keywords Number of keywords in kws.
+/// @param [in, optional] value_ptrs Array of nb_keywords pointers to previously allocated values to associate with the keywords kws.
+/// @param [in, optional] destructor A destructor to be used to free the values pointed by value_ptrs (`free` by default).
+/// @return The number of keywords successfully registered (see ACM_register_keyword).
+/// Note: Keywords are registered in the order of kws, as by successive calls to ACM_register_keyword,
+///       but the storage of the machine is sized for all of them beforehand,
+///       and the failure function is built at the end, rather than by the next call to ACM_match.
+/// Example: ACM_register_keywords (M, kws, 1000);
+#  define ACM_register_keywords(...)                VFUNC(ACM_register_keywords, __VA_ARGS__)
+
 /// int ACM_is_registered_keyword (const ACMachine(T) * machine, Keyword(T) kw, [void **value_ptr])
 /// Checks whether a keyword is already registered in the machine.
 /// @param [in] machine A pointer to a Aho-Corasick machine.
@@ -125,7 +203,8 @@
 /// Unregisters a keyword from the Aho-Corasick machine.
 /// @param [in] machine A pointer to a Aho-Corasick machine.
 /// @param [in] kw Keyword of symbols of type T to be registered.
-/// @return 1 if the keyword was successfully unregistered, 0 otherwise (the keywpord is not registered in the machine).
+/// @return 1 if the keyword was successfully unregistered, 0 otherwise (the keywpord is not registered in the machine,
+///         or the machine is frozen by ACM_build).
 /// Note: The equality operator, either associated to the machine, or associated to the type T, is used if declared.
 #  define ACM_unregister_keyword(machine, keyword)  (machine)->vtable->unregister_keyword ( (machine), (keyword))
 
@@ -135,10 +214,39 @@
 /// @return The number of keywords registered in the machine.
 #  define ACM_nb_keywords(machine)                  (machine)->vtable->nb_keywords ((machine))
 
+/// int ACM_pool_keywords (ACMachine(T) *machine)
+/// Stores the symbols of the registered keywords one after the other in a pool indexed by rank,
+/// so that matching keywords can then be viewed in place by ACM_get_match_view.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @return 1 if the machine has a pool of keywords after the call, 0 otherwise.
+/// Note: The keywords already registered are added to the pool, and the keywords registered later are appended to it.
+///       The pool never shrinks: unregistered keywords keep their place until the machine is released.
+/// Note: The pool is saved by ACM_save and published by ACM_publish together with the machine.
+///       For a machine loaded by ACM_load_mapped, or a snapshot, it only tells whether the image has a pool.
+/// Exemple: ACM_pool_keywords (M);
+#  define ACM_pool_keywords(machine)                (machine)->vtable->pool_keywords ((machine))
+
 /// MatchHolder (T) is the type of a match composed of symbols of type T.
 /// Exemple: MatchHolder (char) match;
 #  define MatchHolder(T)                            MatchHolder_##T
 
+/// MatchRecord (T) is the type of the location of a matching keyword in a text (see ACM_match_records), with fields:
+///   size_t start: position of the first symbol of the keyword in the text;
+///   size_t end: position following the last symbol of the keyword (end - start is the length of the keyword);
+///   size_t rank: rank (unique id) of the keyword;
+///   void *value: pointer to the value associated to the keyword.
+#  define MatchRecord(T)                            MatchRecord_##T
+
+/// MatchStream (T) is the type of the search of a stream of texts by ACM_match_records, carried over its successive texts.
+/// It is initialized to zero before the first text, and released by ACM_end_records after the last one.
+/// Exemple: MatchStream (char) stream = { 0 };
+#  define MatchStream(T)                            MatchStream_##T
+
+/// MatchView (T) is the type of a matching keyword read in place in the pool of keywords of a machine (see ACM_get_match_view).
+/// ACM_MATCH_LENGTH, ACM_MATCH_SYMBOLS and ACM_MATCH_UID apply to it, but not ACM_MATCH_INIT nor ACM_MATCH_RELEASE.
+/// Exemple: MatchView (char) view;
+#  define MatchView(T)                              MatchView_##T
+
 /// size_t ACM_MATCH_LENGTH (MatchHolder(T) match)
 /// Returns the length of a matching keyword.
 /// @param [in] match A matching keyword.
@@ -179,6 +287,114 @@
 
 #  define ACM_print(machine, stream, printer)       (machine)->vtable->print ((machine), (stream), (printer))
 
+/// void ACM_build (ACMachine(T) * machine)
+/// Builds the failure function of the machine once for all and freezes it.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// Note: Without ACM_build, the failure function is rebuilt, if needed, by the first call to ACM_match following
+///       the registration or unregistration of keywords, and each call to ACM_match checks whether it is needed.
+///       After ACM_build, ACM_match and ACM_match_buffer do not check it anymore.
+/// Note: Unless the machine is compiled, ACM_build also builds a flat representation of the machine
+///       (states numbered by 32-bit integers, transitions in contiguous arrays) on which texts are then searched.
+/// Note: Once the machine is frozen, ACM_register_keyword and ACM_unregister_keyword fail and return 0.
+///       A new machine should be created to register other keywords.
+/// Note: ACM_build is not thread-safe, and should be called before searching texts.
+/// Exemple: ACM_build (M);
+#  define ACM_build(machine)                        (machine)->vtable->build ((machine))
+
+/// void ACM_set_build_threads (ACMachine(T) * machine, size_t nb_threads)
+/// Sets the number of threads used to construct the failure function of the machine (1 by default).
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @param [in] nb_threads Number of threads.
+/// Note: The failure function is constructed level by level (states of same depth), and the states of a level
+///       are shared between the threads. Levels of less than ACM_MIN_STATES_PER_THREAD states per thread use fewer threads.
+/// Note: The failure function is constructed by ACM_build, or by the first call to ACM_match following
+///       the registration or unregistration of keywords when it can not be updated incrementally.
+/// Exemple: ACM_set_build_threads (M, 4);
+#  define ACM_set_build_threads(machine, nb_threads)  do { (machine)->nb_build_threads = (nb_threads); } while (0)
+
+/// int ACM_save (const ACMachine(T) * machine, const char *path)
+/// Saves a frozen machine to a file, to be loaded later by ACM_load_mapped.
+/// @param [in] machine A pointer to a Aho-Corasick machine frozen by ACM_build.
+/// @param [in] path Path of the file.
+/// @return 1 if the machine was saved, 0 otherwise (if the machine is not frozen,
+///         if the symbols have a copy constructor, or if the file could not be written).
+/// Note: The file holds the flat representation of the machine (see ACM_build), with offsets instead of pointers,
+///       behind a versioned header. It can only be loaded on hosts of the same byte order and word size.
+/// Note: The file is written under a temporary name, and then renamed to path:
+///       machines which mapped a previous file at path (in this process or others) are not disturbed.
+/// Note: The values associated to the keywords are not saved.
+/// Exemple: ACM_save (M, "words.acm");
+#  define ACM_save(machine, path)                   (machine)->vtable->save ((machine), (path))
+
+/// ACMachine (T) *ACM_load_mapped (T, const char *path, [equality_operator], [less_than_operator])
+/// Loads a machine saved by ACM_save, mapping the file in memory.
+/// @param [in] T type of symbols composing keywords and text to be parsed.
+/// @param [in] path Path of the file.
+/// @param [in, optional] equality_operator Equality operator of type EQ_OPERATOR_TYPE(T).
+/// @param [in, optional] less_than_operator Ordering operator of type LT_OPERATOR_TYPE(T).
+/// @returns A pointer to a frozen Aho-Corasick machine, or 0 if the file is not a machine of symbols of type T
+///          saved by the same version of the library, if it is corrupted, or if the normalizer (see SET_NORMALIZER)
+///          or the user defined hash operator (see SET_HASH_OPERATOR) of the saved machine is not declared, or conversely.
+/// Note: The operators should be the ones of the saved machine, since the file holds the transitions as sorted by it.
+/// Note: Every state number, position and length read from the file is checked once at load, in time linear in its size,
+///       so that searches never read out of the mapping.
+/// Note: Texts are searched directly on the mapped file, without parsing nor copying it:
+///       processes loading the same file share its pages in memory.
+/// Note: Keywords can not be registered nor unregistered, ACM_compile returns 0 and ACM_print prints nothing.
+///       ACM_get_match returns no associated value.
+/// Note: The machine is released by ACM_release.
+/// Example: ACMachine (char) * M = ACM_load_mapped (char, "words.acm");
+#  define ACM_load_mapped(...)                      VFUNC(ACM_load_mapped, __VA_ARGS__)
+
+/// int ACM_publish (ACMachine(T) * machine)
+/// Publishes a snapshot of the keywords currently registered in the machine, for readers running concurrently with updates.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @return 1 if the snapshot was published, 0 otherwise (if the symbols have a copy constructor, or if the machine is mapped).
+/// Note: The snapshot is an immutable copy of the flat representation of the machine (see ACM_build),
+///       which replaces the previously published one at once: readers see all the updates published together, or none.
+/// Note: Snapshots replaced by a later one are released as soon as their last reader releases them
+///       (or by the next call to ACM_publish if a reader was acquiring a snapshot meanwhile).
+///       Values associated to keywords unregistered meanwhile are only destroyed with the snapshots which could read them
+///       (possibly by the reader thread which released the snapshot last).
+/// Note: Each call copies the whole machine (its flat image and the array of its associated values):
+///       ACM_publish costs O(size of the machine), whatever the number of updates since the previous call.
+///       Updates should therefore be batched between calls, rather than published one by one on a large machine.
+/// Note: ACM_publish is called by the thread updating the machine, like ACM_register_keyword.
+/// Exemple: ACM_register_keyword (M, kw); ACM_publish (M);
+#  define ACM_publish(machine)                      (machine)->vtable->publish ((machine))
+
+/// const ACMachine(T) * ACM_snapshot (const ACMachine(T) * machine)
+/// Gets the last snapshot published by ACM_publish.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @return A pointer to a frozen machine, or 0 if no snapshot was published.
+/// Note: ACM_snapshot never waits, and can be called by any thread while keywords are registered or unregistered
+///       in the machine. The snapshot is left unchanged by later updates.
+/// Note: The snapshot is searched like any frozen machine (ACM_reset, ACM_match, ACM_get_match, ...),
+///       and must be released by ACM_release after use, before the machine itself is released.
+/// Exemple: const ACMachine (char) * S = ACM_snapshot (M);
+///          const ACState (char) * s = ACM_reset (S);
+///          ACM_match_buffer (s, text, length, handler);
+///          ACM_release (S);
+#  define ACM_snapshot(machine)                     (machine)->vtable->snapshot ((machine))
+
+/// int ACM_compile (ACMachine(T) * machine)
+/// Compiles the goto and failure functions of the machine into a deterministic finite automaton,
+/// i.e. a dense table of transitions (one per class of symbols and per state) such that each call to ACM_match
+/// is a single indexed load.
+/// For one byte symbols, the classes are the 256 possible symbols.
+/// For larger symbols (wchar_t, int, ...), the classes are the symbols of the keywords, numbered at compilation
+/// (the alphabet of the machine), and one class for all other symbols; symbols of the text are classified by a hash table.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @return 1 if the machine is compiled, 0 otherwise (if symbols of type T are larger than one byte
+///         and compared with an equality operator other than the default one, without hash operator, see SET_HASH_OPERATOR.)
+/// Note: The compiled table is discarded on the next call to ACM_register_keyword or ACM_unregister_keyword.
+///       ACM_compile should then be called again if needed.
+/// Note: The equality operator, either associated to the machine, or associated to the type T, is used if declared.
+/// Note: The memory footprint of the table is 256 pointers per state for one byte symbols,
+///       and the number of distinct symbols in the keywords plus one otherwise.
+/// Exemple: ACM_compile (M);
+#  define ACM_compile(machine)                      (machine)->vtable->compile ((machine))
+
 /// size_t ACM_match (const ACState(T) *& state, T letter)
 /// This is the main function used to parse a text, one symbol after the other, and search for pattern matching.
 /// Get the next state matching a symbol injected in the finite state machine.
@@ -191,6 +407,102 @@
 /// Usage: size_t nb = ACM_match(state, letter);
 #  define ACM_match(state, letter)                  (state)->vtable->match(&(state), (letter))
 
+/// Type for match handler is: void (*handler) (const ACState(T) * state, size_t position, size_t nb_matches, void *context)
+#  define MATCH_HANDLER_TYPE(T)                     MATCH_HANDLER_##T##_TYPE
+
+/// size_t ACM_match_buffer (const ACState(T) *& state, const T *text, size_t length, [MATCH_HANDLER_TYPE(T) handler, [void *context]])
+/// Parses a text of several symbols in a single call, as if ACM_match would have been called on each symbol of the text.
+/// @param [in, out] state A pointer to a valid Aho-Corasick machine state. Argument passed by reference.
+/// @param [in] text An array of symbols.
+/// @param [in] length The number of symbols in text.
+/// @param [in, optional] handler A function called for each position of text where at least one keyword matches.
+///                               handler is called with the state at this position (on which ACM_get_match can be applied),
+///                               the 0-based position of the last matching symbol in text, the number of matches,
+///                               and the context passed to ACM_match_buffer.
+/// @param [in, optional] context A pointer passed to handler.
+/// @return The number of registered keywords that match in text (the sum of the values returned by ACM_match on each symbol).
+/// Note: `state` is passed by reference. It is modified by the function.
+/// Note: Successive calls to ACM_match_buffer (and ACM_match) on the same state continue the search where it stopped.
+/// Note: For symbols of one byte, while at state 0, the text is skipped up to the next symbol which starts a keyword
+///       if there are at most 3 such symbols (with memchr, or SSE2 if available).
+/// Usage: size_t nb = ACM_match_buffer (state, text, length, handler, 0);
+#  define ACM_match_buffer(...)                     VFUNC(ACM_match_buffer, __VA_ARGS__)
+
+/// Type for match record handler is: void (*handler) (MatchRecord(T) record, void *context)
+#  define MATCH_RECORD_HANDLER_TYPE(T)              MATCH_RECORD_HANDLER_##T##_TYPE
+
+/// Modes of ACM_match_records:
+///   ACM_MATCH_ALL: all the matching keywords, overlapping or not;
+///   ACM_MATCH_LEFTMOST_LONGEST: non-overlapping matches, each one starting as early as possible, the longest first;
+///   ACM_MATCH_LEFTMOST_FIRST: non-overlapping matches, each one starting as early as possible, the first registered first (lowest rank).
+/// ACM_MATCH_WORDS can be combined with each of them (by |): only the whole words matching keywords are then reported,
+/// that is the matches not preceded nor followed in text by a word symbol (see SET_WORD_OPERATOR).
+#  define ACM_MATCH_ALL                             0
+#  define ACM_MATCH_LEFTMOST_LONGEST                1
+#  define ACM_MATCH_LEFTMOST_FIRST                  2
+#  define ACM_MATCH_WORDS                           4
+
+/// size_t ACM_match_records (const ACState(T) *& state, const T *text, size_t length, MATCH_RECORD_HANDLER_TYPE(T) handler, [void *context, [size_t offset, [int mode, [MatchStream(T) * stream]]]])
+/// Parses a text of several symbols as ACM_match_buffer does, and reports the location of each matching keyword.
+/// @param [in, out] state A pointer to a valid Aho-Corasick machine state. Argument passed by reference.
+/// @param [in] text An array of symbols.
+/// @param [in] length The number of symbols in text.
+/// @param [in] handler A function called for each matching keyword with its record (start, end, rank and value),
+///                     in the order of the positions of their ends, and in the order of ACM_get_match for a same end,
+///                     and the context passed to ACM_match_records.
+/// @param [in, optional] context A pointer passed to handler.
+/// @param [in, optional] offset The position of text in a stream of texts, added to the positions of the records (0 by default).
+/// @param [in, optional] mode ACM_MATCH_ALL (by default), ACM_MATCH_LEFTMOST_LONGEST or ACM_MATCH_LEFTMOST_FIRST,
+///                        possibly combined with ACM_MATCH_WORDS.
+/// @param [in, out, optional] stream The search of the stream text belongs to, if any (see MatchStream).
+/// @return The number of records reported, i.e. the number of registered keywords that match in text for ACM_MATCH_ALL
+///         (as ACM_match_buffer).
+/// Note: The records are computed from the depth of the matching states, without retrieving the symbols of the keywords.
+/// Note: A stream of texts is searched by successive calls on the same state, offset being the number of symbols
+///       of the previous texts: the start of a record may then be in a previous text.
+/// Note: In the leftmost modes, the matches are resolved in the same single pass on text, in the order of their positions,
+///       a match being reported once no later match can start before it or at the same position.
+///       The matches not reported yet are kept pending, at most one per start, in a window of the length of the longest keyword:
+///       each match is resolved in amortized constant time.
+///       Without stream, text is the whole text: the pending matches are reported at its end.
+///       With a stream, they are carried over to the next text of the stream, up to ACM_end_records,
+///       and a match may then start in a previous text.
+/// Note: With ACM_MATCH_WORDS, the boundaries of each match are checked once, on the symbols before and after it.
+///       Without stream, the beginning and the end of text are boundaries.
+///       With a stream, the last symbols of the previous texts are kept, and a match ending at the end of text is reported
+///       with the next (non empty) text, or by ACM_end_records: only the beginning and the end of the stream are boundaries.
+///       Without a word operator, all the matches are whole words.
+/// Usage: size_t nb = ACM_match_records (state, text, length, handler, context, offset);
+///        size_t nb = ACM_match_records (state, text, length, handler, context, 0, ACM_MATCH_LEFTMOST_LONGEST);
+///        size_t nb = ACM_match_records (state, text, length, handler, context, offset, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+#  define ACM_match_records(...)                    VFUNC(ACM_match_records, __VA_ARGS__)
+
+/// size_t ACM_end_records (const ACState(T) *& state, MATCH_RECORD_HANDLER_TYPE(T) handler, void *context, MatchStream(T) * stream)
+/// Ends the search of a stream of texts by ACM_match_records: reports the matches still pending, and releases the stream.
+/// @param [in, out] state The state passed to ACM_match_records. Argument passed by reference.
+/// @param [in] handler A function called for each matching keyword with its record, as by ACM_match_records.
+/// @param [in] context A pointer passed to handler.
+/// @param [in, out] stream The search of the stream, initialized to zero again.
+/// @return The number of records reported.
+/// Usage: size_t nb = ACM_end_records (state, handler, context, &stream);
+#  define ACM_end_records(state, handler, context, stream)  (state)->vtable->match_records (&(state), 0, 0, (handler), (context), 0, 0, (stream))
+
+/// size_t ACM_match_parallel (ACMachine(T) * machine, const T *text, size_t length, size_t nb_threads, [MATCH_HANDLER_TYPE(T) handler, [void *context]])
+/// Parses a text of several symbols with several threads, each thread searching a chunk of the text.
+/// @param [in] machine A pointer to a Aho-Corasick machine.
+/// @param [in] text An array of symbols.
+/// @param [in] length The number of symbols in text.
+/// @param [in] nb_threads The number of threads (and chunks of text).
+/// @param [in, optional] handler A function called for each position of text where at least one keyword matches,
+///                               as for ACM_match_buffer, with the 0-based position of the last matching symbol in the whole text.
+/// @param [in, optional] context A pointer passed to handler.
+/// @return The number of registered keywords that match in text (as ACM_match_buffer from state 0).
+/// Note: Chunks overlap by the length of the longest keyword minus one symbol, so that keywords across chunks are found,
+///       and each match is reported once, by the thread of the chunk where it ends.
+/// Note: handler is called concurrently by several threads, in no particular order of positions.
+/// Usage: size_t nb = ACM_match_parallel (M, text, length, 4, handler, 0);
+#  define ACM_match_parallel(...)                   VFUNC(ACM_match_parallel, __VA_ARGS__)
+
 /// void ACM_MATCH_INIT (MatchHolder(T) match)
 /// Initializes a match before its first use by ACM_get_match.
 /// @param [in] match A match
@@ -210,6 +522,33 @@
 /// Exemple: size_t rank = ACM_get_match (state, j, &match, 0);
 #  define ACM_get_match(...)                        VFUNC(ACM_get_match, __VA_ARGS__)
 
+/// size_t ACM_foreach_match (const ACState(T) * state, void (*operator) (size_t rank, size_t length, void *value, void *context), [void *context])
+/// Applies an operator to each keyword matching with the last symbols, in a single pass.
+/// @param [in] state A pointer to a valid Aho-Corasick machine state.
+/// @param [in] operator Function called for each matching keyword with its rank (unique id), its length,
+///                      the pointer to its associated value, and context.
+/// @param [in, optional] context A pointer passed to operator.
+/// @return The number of matching keywords, i.e. the value returned by the last call to ACM_match.
+/// Note: The matching keywords are processed in the same order as by ACM_get_match for increasing indexes,
+///       at the cost of a single step per matching keyword.
+/// Exemple: static void count (size_t rank, size_t length, void *value, void *context) { /* user code here */ }
+///          ACM_foreach_match (state, count, 0);
+#  define ACM_foreach_match(...)                    VFUNC(ACM_foreach_match, __VA_ARGS__)
+
+/// size_t ACM_get_match_view (const ACState(T) * state, size_t index, MatchView(T) * view, [void **value_ptr])
+/// Gets the ith keyword matching with the last symbols, as ACM_get_match does, without copying its symbols.
+/// @param [in] state A pointer to a valid Aho-Corasick machine state.
+/// @param [in] index Index (ith) of the ith matching keyword.
+/// @param [out] view *view is set to the ith matching keyword, its symbols pointing into the pool of keywords of the machine.
+/// @param [out, optional] value_ptr *value_ptr is set to the pointer of the value associated to the keyword after the call.
+/// @return The rank (unique id) of the ith matching keyword.
+/// Note: The symbols of the view are 0 if the machine has no pool of keywords (see ACM_pool_keywords).
+/// Note: The view is valid until the next registration of a keyword, or the release of the machine.
+/// Exemple: MatchView (char) view;
+///          ACM_get_match_view (state, j, &view);
+///          fwrite (ACM_MATCH_SYMBOLS (view), 1, ACM_MATCH_LENGTH (view), stdout);
+#  define ACM_get_match_view(...)                   VFUNC(ACM_get_match_view, __VA_ARGS__)
+
 /// void ACM_MATCH_RELEASE (MatchHolder(T) match)
 /// Releases a match after its last use by ACM_get_match.
 /// @param [in] match A match
@@ -218,6 +557,50 @@
 ///       It should not ne applied to a keyword of type Keyword(T).
 #  define ACM_MATCH_RELEASE(match)                  do { free (ACM_MATCH_SYMBOLS (match)); ACM_MATCH_INIT (match); } while (0)
 
+/// ACMIntern is the type of a table of interned strings, which maps each distinct string (such as a word token) to an id.
+/// Phrases of tokens are searched by a machine of ids, of type ACMachine (size_t), rather than of strings (char *):
+/// symbols are then compared by the inlined default equality operator instead of strcoll,
+/// and registered without a copy of the string per transition.
+/// Example: ACMIntern *I = ACM_intern_create ();
+///          size_t ids[] = { ACM_intern (I, "big"), ACM_intern (I, "fat"), ACM_intern (I, "hen") };
+///          Keyword (size_t) k;
+///          ACM_KEYWORD_SET (k, ids, 3);
+///          ACM_register_keyword (M, k);
+///          ...
+///          size_t nb = ACM_match (state, ACM_intern_find (I, token));
+#  define ACMIntern                                 struct _ac_intern
+
+/// ACMIntern *ACM_intern_create (void)
+/// Creates an empty table of interned strings.
+/// @returns A pointer to the table.
+#  define ACM_intern_create()                       __intern_create__ ()
+
+/// void ACM_intern_release (ACMIntern *table)
+/// Releases a table of interned strings, and the strings it holds.
+#  define ACM_intern_release(table)                 __intern_release__ ((table))
+
+/// size_t ACM_intern (ACMIntern *table, const char *string)
+/// Interns a string (the tokens of the keywords).
+/// @param [in] table A pointer to a table of interned strings.
+/// @param [in] string A string, copied in the table if it was not interned yet.
+/// @returns The id of the string: 1 for the first interned string, 2 for the next one...
+#  define ACM_intern(table, string)                 __intern__ ((table), (string))
+
+/// size_t ACM_intern_find (const ACMIntern *table, const char *string)
+/// Finds the id of a string (the tokens of a text), without interning it.
+/// @param [in] table A pointer to a table of interned strings.
+/// @param [in] string A string.
+/// @returns The id of the string, or 0 if it is not interned (it is then in no keyword).
+/// Note: ACM_intern_find can be called concurrently by several threads, but not concurrently with ACM_intern.
+#  define ACM_intern_find(table, string)            __intern_find__ ((table), (string))
+
+/// const char *ACM_intern_string (const ACMIntern *table, size_t id)
+/// Retrieves an interned string (for instance the tokens of a keyword returned by ACM_get_match).
+/// @param [in] table A pointer to a table of interned strings.
+/// @param [in] id The id of a string.
+/// @returns The string of id, or 0 if there is none.
+#  define ACM_intern_string(table, id)              __intern_string__ ((table), (id))
+
 /// Internal declarations ********************************************************************
 
 // BEGIN VFUNC
@@ -247,12 +630,60 @@
 #  define VFUNC(func, ...) _VFUNC(func, __NARG__(__VA_ARGS__)) (__VA_ARGS__)
 // END VFUNC
 
+// BEGIN ARENA
+/// Memory pool of a machine, from which its states, goto arrays and hash tables are allocated.
+struct _ac_arena
+{
+  struct _ac_arena_chunk *chunks; /* Allocated chunks of memory */
+  char *next;                     /* First free byte of the current chunk */
+  size_t left;                    /* Number of free bytes in the current chunk */
+  size_t chunk_size;              /* Size of the next chunk */
+  void *free_blocks[2 * 8 * sizeof (size_t)]; /* Lists of released blocks, by size class (goto arrays, then hash tables) */
+};
+// END ARENA
+
+// BEGIN MAPPED
+/// Fields of a state of a machine saved by ACM_save, only read when a keyword matches.
+struct _ac_mapped_state
+{
+  uint32_t previous;    /* Number of the state s' such that g(s', a) = s */
+  uint32_t output;      /* First matching state in the chain of failure states of s, 0 if none */
+  uint32_t depth;       /* Length of the keyword of a matching state */
+  uint32_t is_matching;
+  uint64_t rank;
+};
+
+/// Value associated to an unregistered keyword, destroyed once no published snapshot can read it (see ACM_publish).
+struct _ac_retired_value
+{
+  void *value;
+  void (*dtor) (void *);
+  struct _ac_retired_value *next;
+};
+// END MAPPED
+
+// BEGIN INTERN
+/// Table of interned strings (see ACM_intern).
+struct _ac_intern
+{
+  struct _ac_arena arena; /* Storage of the strings */
+  const char **string;    /* Interned strings by id (id 0 stands for no string) */
+  size_t nb_strings;      /* Number of ids, including id 0 */
+  size_t *hash;           /* Hash table of the ids of the strings */
+  size_t hash_mask;
+};
+// END INTERN
+
 // BEGIN DECLARE_ACM
 #  define ACM_DECLARE(T)                             \
 \
 typedef T (*COPY_##T##_TYPE) (const T);              \
 typedef void (*DESTROY_##T##_TYPE) (const T);        \
 typedef int (*EQ_##T##_TYPE) (const T, const T);     \
+typedef int (*LT_##T##_TYPE) (const T, const T);     \
+typedef size_t (*HASH_##T##_TYPE) (const T);        \
+typedef T (*NORM_##T##_TYPE) (const T);              \
+typedef int (*WORD_##T##_TYPE) (const T);            \
 \
 typedef struct                                       \
 {                                                    \
@@ -267,15 +698,57 @@ typedef struct                                       \
   size_t rank;    /* Rank of the regidtered keyword */\
 } MatchHolder_##T;                                   \
 \
+typedef struct                                       \
+{                                                    \
+  size_t start;   /* Position of the first symbol of the keyword in the text */\
+  size_t end;     /* Position following the last symbol of the keyword */\
+  size_t rank;    /* Rank of the registered keyword */\
+  void *value;    /* Value associated to the keyword */\
+} MatchRecord_##T;                                   \
+\
+typedef struct                                       \
+{                                                    \
+  int started;    /* Whether a text of the stream was searched */\
+  int mode;       /* Mode of the search */           \
+  size_t begin;   /* Position of the first text */   \
+  size_t last_end; /* End of the last reported match, in the leftmost modes */\
+  MatchRecord_##T *pending; /* Pending matches, by start modulo size, in the leftmost modes (end 0 for none) */\
+  size_t size;    /* Number of slots of pending: the length of the longest keyword, plus one */\
+  size_t nb_pending;                                 \
+  size_t first;   /* Lowest start of the pending matches */\
+  unsigned char *is_word_at; /* Whether the last size symbols are word symbols, by position modulo size, with ACM_MATCH_WORDS */\
+  MatchRecord_##T *deferred; /* Matches ending at the end of the last text, with ACM_MATCH_WORDS */\
+  size_t nb_deferred;                                \
+  size_t size_deferred;                              \
+} MatchStream_##T;                                   \
+\
+typedef struct                                       \
+{                                                    \
+  const T *letter; /* Symbols of the keyword in the pool of keywords */\
+  size_t length;  /* Length of the keyword */        \
+  size_t rank;    /* Rank of the registered keyword */\
+} MatchView_##T;                                     \
+\
 struct _ac_state_##T;                                \
 typedef struct _ac_state_##T ACState_##T;            \
 struct _ac_machine_##T;                              \
 typedef struct _ac_machine_##T ACMachine_##T;        \
 typedef int (*PRINT_##T##_TYPE) (FILE *, T);         \
+typedef void (*MATCH_HANDLER_##T##_TYPE) (const ACState_##T *, size_t, size_t, void *);  \
+typedef void (*MATCH_RECORD_HANDLER_##T##_TYPE) (MatchRecord_##T, void *);  \
 struct _acs_vtable_##T                               \
 {                                                    \
   size_t (*match) (const ACState_##T ** state, T letter);                                                    \
+  size_t (*match_buffer) (const ACState_##T ** state, const T * text, size_t length,                         \
+                          MATCH_HANDLER_##T##_TYPE handler, void *context);                                  \
   size_t (*get_match) (const ACState_##T * state, size_t index, MatchHolder_##T * match, void **value);      \
+  size_t (*foreach_match) (const ACState_##T * state,                                                        \
+                           void (*operator) (size_t rank, size_t length, void *value, void *context),        \
+                           void *context);                                                                   \
+  size_t (*match_records) (const ACState_##T ** state, const T * text, size_t length,                        \
+                           MATCH_RECORD_HANDLER_##T##_TYPE handler, void *context, size_t offset, int mode,  \
+                           MatchStream_##T * stream);                                                        \
+  size_t (*get_match_view) (const ACState_##T * state, size_t index, MatchView_##T * view, void **value);    \
 };                                                   \
 /* A state of the state machine. */                  \
 struct _ac_state_##T             /* [state s] */     \
@@ -287,6 +760,7 @@ struct _ac_state_##T             /* [state s] */     \
     struct _ac_state_##T *state; /* [g(s, letter)] */\
   } *goto_array;                 /* next states in the tree of the goto function */\
   size_t nb_goto;                                    \
+  size_t *goto_hash; /* Hash table of the positions in goto_array, for states with many transitions (see SET_HASH_OPERATOR) */\
   /* A link to the previous states */                \
   struct                                             \
   {                                                  \
@@ -295,19 +769,63 @@ struct _ac_state_##T             /* [state s] */     \
     struct _ac_state_##T *state;                     \
   } previous;                    /* Previous state */\
   const struct _ac_state_##T *fail_state; /* [f(s)] */\
+  /* Links in the tree of the inverse of the failure function: the children of s are the states r such that f(r) = s. */\
+  struct                                             \
+  {                                                  \
+    struct _ac_state_##T *first_child;               \
+    struct _ac_state_##T *next_sibling;              \
+    struct _ac_state_##T *previous_sibling;          \
+  } fail_tree;                                       \
+  const struct _ac_state_##T *output_state; /* First matching state in the chain of failure states of s */\
+  const struct _ac_state_##T **transition; /* [delta(s, a)] for all symbols a, if the machine is compiled */\
   int is_matching; /* true if the state matches a keyword. */\
   size_t nb_sequence; /* Number of matching keywords (Aho-Corasick : size (output (s)) */\
   size_t rank; /* Rank (0-based) of insertion of a keyword in the machine. */\
+  size_t depth; /* Number of symbols from state 0 to s, i.e. length of the keyword of a matching state */\
   size_t id;   /* state UID */                       \
+  uint32_t index; /* Number of the state in the flat representation of a frozen machine */\
   void *value; /* An optional value associated to a state. */\
   void (*value_dtor) (void *); /* Destrcutor of the associated value, called a state machine release. */\
   ACMachine_##T * machine;                           \
   const struct _acs_vtable_##T *vtable;              \
 };                                                   \
 \
+/* Flat representation of a frozen machine (see ACM_build): states are numbered in breadth-first order. */\
+/* The fields read by the matching loop are packed in contiguous arrays indexed by state number, */\
+/* apart from the other fields, which are kept in the states of the tree. */\
+struct _ac_flat_##T                                  \
+{                                                    \
+  struct _ac_hot_state_##T                           \
+  {                                                  \
+    uint32_t first_edge; /* Position of the first transition of s in edge_letter and edge_target */\
+    uint32_t nb_goto;                                \
+    uint32_t fail;        /* [f(s)], 0 for state 0 */\
+    uint32_t nb_sequence; /* [size (output (s))] */  \
+  } *hot;                                            \
+  T *edge_letter;         /* [a] for each transition [g(s, a)], in the order of goto_array */\
+  uint32_t *edge_target;  /* [g(s, a)] */            \
+  uint32_t *root;         /* [g(0, a)] for all symbols a of one byte */\
+  /* Hash tables of the transitions of the states with many transitions, as in the tree (see state_goto_hash_update): */\
+  uint32_t *hash_offset;  /* Position of the hash table of a state in hash_table */\
+  uint32_t *hash_table;   /* Positions + 1 of the transitions from first_edge */\
+  size_t nb_hash_slots;   /* Size of hash_table */   \
+  size_t (*hash) (const T); /* Hash operator of the hash tables, 0 if there are none */\
+  const struct _ac_state_##T **state; /* State of the tree with a given number, 0 for a mapped machine */\
+  /* A machine loaded by ACM_load_mapped has no tree: its arrays are read from the mapped file, */\
+  /* and its states are handles initialized on first use. */\
+  const struct _ac_mapped_state *cold; /* Fields of the states read on matches */\
+  struct _ac_state_##T *handle; /* States of the mapped machine, by number */\
+  void *map;              /* Mapped file, or image of a snapshot (see ACM_publish) */\
+  size_t map_length;                                 \
+  int mapped;             /* map is a mapped file */ \
+  void **value;           /* Associated values of the states of a snapshot, 0 otherwise */\
+};                                                   \
+\
 struct _acm_vtable_##T                               \
 {                                                    \
   int (*register_keyword) (ACMachine_##T * machine, Keyword_##T keyword, void *value, void (*dtor) (void *)); \
+  size_t (*register_keywords) (ACMachine_##T * machine, const Keyword_##T * keywords, size_t nb_keywords,     \
+                               void **values, void (*dtor) (void *));                                         \
   int (*is_registered_keyword) (const ACMachine_##T * machine, Keyword_##T keyword, void **value);            \
   int (*unregister_keyword) (ACMachine_##T * machine, Keyword_##T keyword);                                   \
   size_t (*nb_keywords) (const ACMachine_##T * machine);                                                      \
@@ -315,6 +833,14 @@ struct _acm_vtable_##T                               \
   void (*release) (const ACMachine_##T * machine);                                                            \
   const ACState_##T * (*reset) (const ACMachine_##T * machine);                                               \
   void (*print) (ACMachine_##T * machine, FILE * stream, PRINT_##T##_TYPE printer);                           \
+  int (*compile) (ACMachine_##T * machine);                                                                   \
+  void (*build) (ACMachine_##T * machine);                                                                    \
+  size_t (*match_parallel) (ACMachine_##T * machine, const T * text, size_t length, size_t nb_threads,        \
+                            MATCH_HANDLER_##T##_TYPE handler, void *context);                                 \
+  int (*save) (const ACMachine_##T * machine, const char *path);                                              \
+  int (*publish) (ACMachine_##T * machine);                                                                   \
+  const ACMachine_##T * (*snapshot) (const ACMachine_##T * machine);                                          \
+  int (*pool_keywords) (ACMachine_##T * machine);                                                             \
 };                                                   \
 \
 struct _ac_machine_##T                               \
@@ -325,38 +851,107 @@ struct _ac_machine_##T                               \
   size_t state_counter;                              \
   int reconstruct;                                   \
   size_t size;                                       \
+  size_t max_depth; /* Length of the longest keyword registered (not decreased by unregistration) */\
+  size_t nb_build_threads; /* Number of threads constructing the failure function (see ACM_set_build_threads) */\
+  const struct _ac_state_##T **transitions; /* Transition table [delta] of the compiled machine, nb_classes per state */\
+  size_t nb_classes; /* Number of classes of symbols of the compiled machine (see ACM_compile) */\
+  T *alphabet; /* Symbols of the keywords of a compiled machine by class, for symbols larger than one byte */\
+  size_t *alphabet_hash; /* Hash table of the classes of the symbols of alphabet */\
+  size_t alphabet_hash_mask;                         \
+  const struct _ac_state_##T **root_transition; /* [g(0, a)] for all symbols a of one byte */\
+  unsigned char root_byte[3]; /* Symbols of one byte a such that g(0, a) != fail, skipped to from state 0 */\
+  size_t nb_root_bytes; /* Number of symbols in root_byte, 0 if there are none or more than 3 */\
+  struct _ac_flat_##T *flat; /* Flat representation of the frozen machine */\
+  int frozen; /* Keywords can not be registered nor unregistered anymore (see ACM_build) */\
+  struct _ac_arena arena; /* Storage of the states (except state 0), of the goto arrays and of their hash tables */\
+  size_t nb_value_dtor; /* Number of associated values with a destructor */\
+  /* Snapshots for concurrent readers (see ACM_publish) */\
+  struct _ac_machine_##T *snapshot; /* Last published snapshot */\
+  struct _ac_machine_##T *retired; /* Snapshots replaced by a later one, oldest first (for a snapshot: the next one) */\
+  struct _ac_retired_value *retired_values; /* Values released since the last snapshot was published */\
+                                            /* (for a snapshot: values to destroy with it) */\
+  size_t nb_acquiring; /* Readers in ACM_snapshot which have not counted their reference yet */\
+  size_t nb_references; /* Readers of a snapshot */ \
+  struct _ac_machine_##T *publisher; /* For a snapshot: the machine which published it */\
+  pthread_mutex_t retired_lock; /* Guards retired, reclaimed by the writer and by the readers (see ACM_publish) */\
   pthread_mutex_t lock;                              \
   const struct _acm_vtable_##T *vtable;              \
   T (*copy) (const T);                               \
   void (*destroy) (const T);                         \
   int (*eq) (const T, const T);                      \
+  int (*lt) (const T, const T); /* Order of goto_array, if defined */\
+  T (*normalize) (const T); /* Normalizer of the symbols of keywords and texts, if defined */\
+  int (*is_word) (const T); /* Word symbol predicate, if defined (see SET_WORD_OPERATOR) */\
+  size_t (*hash) (const T); /* Hash operator consistent with eq, if any (see SET_HASH_OPERATOR) */\
+  /* Pool of keywords (see ACM_pool_keywords), read in place in the image of a mapped machine or of a snapshot */\
+  T *pool; /* Symbols of the registered keywords, one after the other, 0 if there is no pool */\
+  size_t pool_length; /* Number of symbols in pool */\
+  size_t pool_size; /* Allocated size of pool, 0 if pool is read in an image */\
+  size_t *pool_offset; /* Position in pool of the keyword of each rank */\
+  size_t pool_nb_offsets; /* Allocated size of pool_offset */\
 };                                                   \
 \
 __attribute__ ((unused)) ACMachine_##T *ACM_create_##T (EQ_##T##_TYPE eq,        \
                                       COPY_##T##_TYPE copier,  \
-                                      DESTROY_##T##_TYPE dtor);  \
+                                      DESTROY_##T##_TYPE dtor, \
+                                      LT_##T##_TYPE lt);       \
+__attribute__ ((unused)) ACMachine_##T *ACM_load_mapped_##T (const char *path,  \
+                                      EQ_##T##_TYPE eq,        \
+                                      LT_##T##_TYPE lt);       \
 struct __useless_struct_to_allow_trailing_semicolon__##T##__
 // END DECLARE_ACM
 
 // BEGIN MACROS
-#  define ACM_create4(T, eq, copy, dtor)       ACM_create_##T((eq), (copy), (dtor))
+#  define ACM_create5(T, eq, copy, dtor, lt)   ACM_create_##T((eq), (copy), (dtor), (lt))
+#  define ACM_create4(T, eq, copy, dtor)       ACM_create5(T, (eq), (copy), (dtor), 0)
+#  define ACM_create3(T, eq, lt)               ACM_create5(T, (eq), 0, 0, (lt))
 #  define ACM_create2(T, eq)                   ACM_create4(T, (eq), 0, 0)
 #  define ACM_create1(T)                       ACM_create4(T, 0, 0, 0)
 
+#  define ACM_load_mapped4(T, path, eq, lt)    ACM_load_mapped_##T((path), (eq), (lt))
+#  define ACM_load_mapped3(T, path, eq)        ACM_load_mapped4(T, (path), (eq), 0)
+#  define ACM_load_mapped2(T, path)            ACM_load_mapped4(T, (path), 0, 0)
+
 #  define ACM_register_keyword4(machine, keyword, value, dtor)  (machine)->vtable->register_keyword ((machine), (keyword), (value), (dtor))
 #  define ACM_register_keyword3(machine, keyword, value)        ACM_register_keyword4((machine), (keyword), (value), free)
 #  define ACM_register_keyword2(machine, keyword)               ACM_register_keyword4((machine), (keyword), 0, 0)
 
+#  define ACM_register_keywords5(machine, keywords, nb_keywords, values, dtor)  (machine)->vtable->register_keywords ((machine), (keywords), (nb_keywords), (values), (dtor))
+#  define ACM_register_keywords4(machine, keywords, nb_keywords, values)        ACM_register_keywords5((machine), (keywords), (nb_keywords), (values), free)
+#  define ACM_register_keywords3(machine, keywords, nb_keywords)                ACM_register_keywords5((machine), (keywords), (nb_keywords), 0, 0)
+
 #  define ACM_is_registered_keyword3(machine, keyword, value)   (machine)->vtable->is_registered_keyword ((machine), (keyword), (value))
 #  define ACM_is_registered_keyword2(machine, keyword)          ACM_is_registered_keyword3((machine), (keyword), 0)
 
+#  define ACM_match_buffer5(state, text, length, handler, context)  (state)->vtable->match_buffer (&(state), (text), (length), (handler), (context))
+#  define ACM_match_buffer4(state, text, length, handler)  ACM_match_buffer5((state), (text), (length), (handler), 0)
+#  define ACM_match_buffer3(state, text, length)           ACM_match_buffer5((state), (text), (length), 0, 0)
+
+#  define ACM_match_records8(state, text, length, handler, context, offset, mode, stream)  (state)->vtable->match_records (&(state), (text), (length), (handler), (context), (offset), (mode), (stream))
+#  define ACM_match_records7(state, text, length, handler, context, offset, mode)  ACM_match_records8((state), (text), (length), (handler), (context), (offset), (mode), 0)
+#  define ACM_match_records6(state, text, length, handler, context, offset)  ACM_match_records7((state), (text), (length), (handler), (context), (offset), ACM_MATCH_ALL)
+#  define ACM_match_records5(state, text, length, handler, context)  ACM_match_records6((state), (text), (length), (handler), (context), 0)
+#  define ACM_match_records4(state, text, length, handler)           ACM_match_records6((state), (text), (length), (handler), 0, 0)
+
+#  define ACM_match_parallel6(machine, text, length, nb_threads, handler, context)  (machine)->vtable->match_parallel ((machine), (text), (length), (nb_threads), (handler), (context))
+#  define ACM_match_parallel5(machine, text, length, nb_threads, handler)  ACM_match_parallel6((machine), (text), (length), (nb_threads), (handler), 0)
+#  define ACM_match_parallel4(machine, text, length, nb_threads)           ACM_match_parallel6((machine), (text), (length), (nb_threads), 0, 0)
+
+#  define ACM_foreach_match3(state, operator, context)          (state)->vtable->foreach_match ((state), (operator), (context))
+#  define ACM_foreach_match2(state, operator)                   ACM_foreach_match3((state), (operator), 0)
+
 #  define ACM_get_match4(state, index, matchholder, value)      (state)->vtable->get_match ((state), (index), (matchholder), (value))
 #  define ACM_get_match3(state, index, matchholder)             ACM_get_match4((state), (index), (matchholder), 0)
 #  define ACM_get_match2(state, index)                          ACM_get_match4((state), (index), 0, 0)
 
+#  define ACM_get_match_view4(state, index, view, value)        (state)->vtable->get_match_view ((state), (index), (view), (value))
+#  define ACM_get_match_view3(state, index, view)               ACM_get_match_view4((state), (index), (view), 0)
+
 #if defined(__GNUC__) || defined (__clang__)
-#define ACM_DECL5(var, T, eq, copy, dtor)  \
-__attribute__ ((cleanup (ACM_cleanup_##T))) ACMachine_##T var; machine_init_##T (&(var), state_create_##T (), (eq), (copy), (dtor))
+#define ACM_DECL6(var, T, eq, copy, dtor, lt)  \
+__attribute__ ((cleanup (ACM_cleanup_##T))) ACMachine_##T var; machine_init_##T (&(var), state_create_##T (), (eq), (copy), (dtor), (lt))
+#define ACM_DECL5(var, T, eq, copy, dtor) ACM_DECL6(var, T, (eq), (copy), (dtor), 0)
+#define ACM_DECL4(var, T, eq, lt) ACM_DECL6(var, T, (eq), 0, 0, (lt))
 #define ACM_DECL3(var, T, eq) ACM_DECL5(var, T, (eq), 0, 0)
 #define ACM_DECL2(var, T) ACM_DECL3(var, T, 0)
 #define ACM_DECL(...) VFUNC(ACM_DECL, __VA_ARGS__)
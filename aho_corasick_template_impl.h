@@ -30,8 +30,17 @@
 #  include <pthread.h>
 #  include <string.h>
 #  include <signal.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  ifdef __SSE2__
+#    include <emmintrin.h>
+#  endif
 
 #  define ACM_KEEP_VALUE 0  //  Configures the behavior of ACM_register_keyword_##ACM_SYMBOL if a keyword was already previously registered.
+#  define ACM_MIN_STATES_PER_THREAD 4096  //  Minimum number of states of a level given to each thread by the construction of the failure function.
+#  define ACM_HASH_MIN_FANOUT 16  //  Minimum number of transitions of a state indexed by a hash table (see SET_HASH_OPERATOR).
 #  include "aho_corasick_template.h"
 
 #  define ACM_ASSERT(cond) do { if (!(cond)) { \
@@ -39,6 +48,397 @@
       pthread_exit(0) ;\
 } } while (0)
 
+struct _ac_arena_chunk
+{
+  struct _ac_arena_chunk *next;
+  max_align_t data[];
+};
+
+#  define ACM_ARENA_MIN_CHUNK ((size_t) 1 << 12)
+#  define ACM_ARENA_MAX_CHUNK ((size_t) 1 << 20)
+#  define ACM_ARENA_MAX_RESERVE ((size_t) 1 << 26)
+#  define ACM_ARENA_HASH_CLASS (8 * sizeof (size_t))  /* Size class of the hash tables of 2^k slots: ACM_ARENA_HASH_CLASS + k */
+
+static void
+__arena_init__ (struct _ac_arena *arena)
+{
+  arena->chunks = 0;
+  arena->next = 0;
+  arena->left = 0;
+  arena->chunk_size = ACM_ARENA_MIN_CHUNK;
+  for (size_t k = 0; k < sizeof (arena->free_blocks) / sizeof (*arena->free_blocks); k++)
+    arena->free_blocks[k] = 0;
+}
+
+/* Allocates a block of size bytes in the size class k: a block previously released in class k is reused first. */
+static void *
+__arena_alloc__ (struct _ac_arena *arena, size_t size, size_t k)
+{
+  void *block = arena->free_blocks[k];
+  if (block)
+  {
+    arena->free_blocks[k] = *(void **) block;
+    return block;
+  }
+  size = (size + sizeof (max_align_t) - 1) / sizeof (max_align_t) * sizeof (max_align_t);
+  if (size > arena->left)
+  {
+    size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+    struct _ac_arena_chunk *chunk = malloc (sizeof (*chunk) + chunk_size);
+    ACM_ASSERT (chunk);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    /* A block larger than a chunk gets a chunk of its own, and the current chunk is kept. */
+    if (size > arena->chunk_size)
+      return chunk->data;
+    arena->next = (char *) chunk->data;
+    arena->left = chunk_size;
+    if (arena->chunk_size < ACM_ARENA_MAX_CHUNK)
+      arena->chunk_size *= 2;
+  }
+  block = arena->next;
+  arena->next += size;
+  arena->left -= size;
+  return block;
+}
+
+/* Prepares the arena for about size more bytes: the next chunks are made larger */
+/* (up to ACM_ARENA_MAX_RESERVE bytes) so that those bytes are allocated in a few calls to malloc. */
+static void
+__arena_reserve__ (struct _ac_arena *arena, size_t size)
+{
+  if (size > ACM_ARENA_MAX_RESERVE)
+    size = ACM_ARENA_MAX_RESERVE;
+  if (size > arena->chunk_size)
+    arena->chunk_size = size;
+}
+
+/* Releases a block of the size class k, for later reuse. */
+static void
+__arena_free__ (struct _ac_arena *arena, void *block, size_t k)
+{
+  *(void **) block = arena->free_blocks[k];
+  arena->free_blocks[k] = block;
+}
+
+/* Mask of an open addressing hash table of n > 0 entries, kept at most half full: */
+/* its size is the smallest power of 2 not lower than 2 n, so that it only depends on n. */
+static size_t
+__hash_mask__ (size_t n)
+{
+  return (size_t) (~0ULL >> __builtin_clzll ((unsigned long long) (2 * n - 1)));
+}
+
+/* Releases all the blocks at once. */
+static void
+__arena_release__ (struct _ac_arena *arena)
+{
+  while (arena->chunks)
+  {
+    struct _ac_arena_chunk *next = arena->chunks->next;
+    free (arena->chunks);
+    arena->chunks = next;
+  }
+  __arena_init__ (arena);
+}
+
+/* Interned strings (see ACM_intern) are stored in an arena, and their ids in an open addressing hash table, */
+/* kept at most half full, of the FNV-1a hash of their bytes. */
+static size_t
+__intern_hash__ (const char *string)
+{
+  uint64_t h = UINT64_C (14695981039346656037);
+  for (const unsigned char *p = (const unsigned char *) string; *p; p++)
+    h = (h ^ *p) * UINT64_C (1099511628211);
+  return (size_t) h;
+}
+
+/* Slot of the hash table holding the id of string, or empty slot where it would be inserted. */
+static size_t
+__intern_slot__ (const struct _ac_intern *table, const char *string)
+{
+  size_t h = __intern_hash__ (string) & table->hash_mask;
+  while (table->hash[h] && strcmp (table->string[table->hash[h]], string))
+    h = (h + 1) & table->hash_mask;
+  return h;
+}
+
+__attribute__ ((unused)) static struct _ac_intern *
+__intern_create__ (void)
+{
+  struct _ac_intern *table = malloc (sizeof (*table));
+  ACM_ASSERT (table);
+  __arena_init__ (&table->arena);
+  table->hash_mask = 15;
+  ACM_ASSERT (table->hash = calloc (table->hash_mask + 1, sizeof (*table->hash)));
+  ACM_ASSERT (table->string = malloc (sizeof (*table->string) * (table->hash_mask + 1) / 2));
+  table->string[0] = 0;
+  table->nb_strings = 1;
+  return table;
+}
+
+__attribute__ ((unused)) static void
+__intern_release__ (struct _ac_intern *table)
+{
+  __arena_release__ (&table->arena);
+  free (table->hash);
+  free (table->string);
+  free (table);
+}
+
+__attribute__ ((unused)) static size_t
+__intern__ (struct _ac_intern *table, const char *string)
+{
+  size_t h = __intern_slot__ (table, string);
+  if (table->hash[h])
+    return table->hash[h];
+  if (2 * (table->nb_strings + 1) > table->hash_mask + 1)
+  {
+    size_t size = 2 * (table->hash_mask + 1);
+    free (table->hash);
+    ACM_ASSERT (table->hash = calloc (size, sizeof (*table->hash)));
+    ACM_ASSERT (table->string = realloc (table->string, sizeof (*table->string) * size / 2));
+    table->hash_mask = size - 1;
+    for (size_t id = 1; id < table->nb_strings; id++)
+    {
+      h = __intern_hash__ (table->string[id]) & table->hash_mask;
+      while (table->hash[h])
+        h = (h + 1) & table->hash_mask;
+      table->hash[h] = id;
+    }
+    h = __intern_slot__ (table, string);
+  }
+  /* Strings are never released one by one: they are packed in the chunks of the arena, without a malloc each. */
+  size_t length = strlen (string) + 1;
+  char *copy = __arena_alloc__ (&table->arena, length, 0);
+  memcpy (copy, string, length);
+  table->string[table->nb_strings] = copy;
+  return table->hash[h] = table->nb_strings++;
+}
+
+__attribute__ ((unused)) static size_t
+__intern_find__ (const struct _ac_intern *table, const char *string)
+{
+  return table->hash[__intern_slot__ (table, string)];
+}
+
+__attribute__ ((unused)) static const char *
+__intern_string__ (const struct _ac_intern *table, size_t id)
+{
+  return id < table->nb_strings ? table->string[id] : 0;
+}
+
+#  define ACM_FILE_MAGIC "ACMACHN"
+#  define ACM_FILE_VERSION 4
+#  define ACM_FILE_BYTE_ORDER UINT32_C (0x01020304)
+#  define ACM_FILE_ALIGN 64
+#  define ACM_FILE_SORTED 1     /* Transitions are sorted by the ordering operator */
+#  define ACM_FILE_BYTEWISE 2   /* Symbols are compared byte per byte, as by the root index */
+#  define ACM_FILE_DEFAULT_HASH 4  /* Hash tables are built with the default hash operator */
+#  define ACM_FILE_CUSTOM_HASH 8   /* Hash tables are built with a user defined hash operator (see SET_HASH_OPERATOR) */
+#  define ACM_FILE_NORMALIZED 16   /* Keywords are normalized (see SET_NORMALIZER) */
+
+/* Header of a file written by ACM_save. */
+/* Sections are located by their offsets from the beginning of the file, aligned on ACM_FILE_ALIGN bytes. */
+struct _ac_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;  /* ACM_FILE_BYTE_ORDER, as written by the saving host */
+  char symbol[32];      /* Name of the type of symbols */
+  uint32_t symbol_size;
+  uint32_t word_size;   /* sizeof (size_t), for the hash tables */
+  uint32_t flags;
+  uint32_t nb_states;
+  uint64_t nb_keywords;
+  uint64_t rank;
+  uint64_t max_depth;
+  uint64_t nb_hash_slots;
+  uint64_t hot;         /* [struct _ac_hot_state] x nb_states */
+  uint64_t edge_letter; /* [T] x (nb_states - 1) */
+  uint64_t edge_target; /* [uint32_t] x (nb_states - 1) */
+  uint64_t cold;        /* [struct _ac_mapped_state] x nb_states */
+  uint64_t root;        /* [uint32_t] x 256, or 0 */
+  uint64_t hash_offset; /* [uint32_t] x nb_states, or 0 */
+  uint64_t hash_table;  /* [uint32_t] x nb_hash_slots, or 0 */
+  uint64_t pool_length; /* Number of symbols in the pool of keywords */
+  uint64_t pool;        /* [T] x pool_length, or 0 */
+  uint64_t pool_offset; /* [size_t] x rank, or 0 */
+  uint64_t length;      /* Length of the file */
+};
+
+static uint64_t
+__file_align__ (uint64_t offset)
+{
+  return (offset + ACM_FILE_ALIGN - 1) / ACM_FILE_ALIGN * ACM_FILE_ALIGN;
+}
+
+/* Opens a temporary file next to path, to be renamed to path by __file_close__. */
+/* A file mapped by other machines (possibly in other processes) is thereby replaced, and never modified in place. */
+static FILE *
+__file_open__ (const char *path, char **tmp)
+{
+  size_t length = strlen (path);
+  if (!(*tmp = malloc (length + sizeof (".XXXXXX"))))
+    return 0;
+  memcpy (*tmp, path, length);
+  memcpy (*tmp + length, ".XXXXXX", sizeof (".XXXXXX"));
+  int fd = mkstemp (*tmp);
+  /* The file is made readable by all, as files created by fopen usually are, to be mapped by other processes. */
+  FILE *stream = fd < 0 || fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) ? 0 : fdopen (fd, "wb");
+  if (!stream)
+  {
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (*tmp);
+    }
+    free (*tmp);
+    *tmp = 0;
+  }
+  return stream;
+}
+
+static int
+__file_close__ (FILE * stream, char *tmp, const char *path, int ok)
+{
+  if (!stream)
+    return 0;
+  if (fclose (stream))
+    ok = 0;
+  if (ok && rename (tmp, path))
+    ok = 0;
+  if (!ok)
+    unlink (tmp);
+  free (tmp);
+  return ok;
+}
+
+/* Writes size bytes of data to path, through a temporary file. */
+static int
+__file_save__ (const char *path, const void *data, size_t size)
+{
+  char *tmp;
+  FILE *stream = __file_open__ (path, &tmp);
+  return __file_close__ (stream, tmp, path, stream && fwrite (data, size, 1, stream) == 1);
+}
+
+static int
+__file_section_fits__ (uint64_t offset, uint64_t size, uint64_t length)
+{
+  return offset <= length && size <= length - offset;
+}
+
+/* Checks once for all that the numbers of states and of transitions stored in a mapped file are in range, */
+/* and that the chains followed by the searches (failure states, outputs, predecessors) get shorter at each step, */
+/* so that a truncated, corrupted or foreign file can not make the searches read out of the file, nor loop. */
+static int
+__file_check__ (const char *image, const struct _ac_file_header *header)
+{
+  uint64_t n = header->nb_states;
+  const uint32_t *hot = (const uint32_t *) (image + header->hot);      /* first_edge, nb_goto, fail, nb_sequence */
+  const uint32_t *edge_target = (const uint32_t *) (image + header->edge_target);
+  const struct _ac_mapped_state *cold = (const struct _ac_mapped_state *) (image + header->cold);
+  const uint32_t *root = header->root ? (const uint32_t *) (image + header->root) : 0;
+  const uint32_t *hash_offset = header->hash_table ? (const uint32_t *) (image + header->hash_offset) : 0;
+  const uint32_t *hash_table = header->hash_table ? (const uint32_t *) (image + header->hash_table) : 0;
+  const size_t *pool_offset = header->pool ? (const size_t *) (image + header->pool_offset) : 0;
+  /* The transition to state number s is stored at position s - 1, from state previous (s). */
+  for (uint64_t e = 0; e + 1 < n; e++)
+    if (edge_target[e] != e + 1)
+      return 0;
+  if (hot[2] || cold[0].depth || cold[0].is_matching || cold[0].output || hot[3])
+    return 0;
+  uint64_t nb_keywords = 0;
+  for (uint64_t s = 0; s < n; s++)
+  {
+    uint64_t first_edge = hot[4 * s], nb_goto = hot[4 * s + 1], fail = hot[4 * s + 2], output = cold[s].output;
+    if (first_edge > n - 1 || nb_goto > n - 1 - first_edge || fail >= n || output >= n || cold[s].depth > header->max_depth)
+      return 0;
+    for (uint64_t e = first_edge; e < first_edge + nb_goto; e++)
+      if (cold[e + 1].previous != s)
+        return 0;
+    if (s && (cold[s].previous >= n || cold[cold[s].previous].depth + 1 != cold[s].depth ||
+              cold[fail].depth >= cold[s].depth || (output && (!cold[output].is_matching || cold[output].depth >= cold[s].depth))))
+      return 0;
+    /* The outputs of s are s itself if it matches, followed by the outputs of output (s). */
+    if (hot[4 * s + 3] != (cold[s].is_matching ? 1 : 0) + (output ? hot[4 * output + 3] : 0))
+      return 0;
+    if (cold[s].is_matching)
+    {
+      nb_keywords++;
+      if (cold[s].rank >= header->rank ||
+          (pool_offset && (pool_offset[cold[s].rank] > header->pool_length ||
+                           cold[s].depth > header->pool_length - pool_offset[cold[s].rank])))
+        return 0;
+    }
+    if (hash_table && nb_goto >= ACM_HASH_MIN_FANOUT)
+    {
+      uint64_t size = __hash_mask__ (nb_goto) + 1, empty = 0;
+      if (hash_offset[s] > header->nb_hash_slots || size > header->nb_hash_slots - hash_offset[s])
+        return 0;
+      for (uint64_t h = 0; h < size; h++)
+        if (!hash_table[hash_offset[s] + h])
+          empty++;
+        else if (hash_table[hash_offset[s] + h] > nb_goto)
+          return 0;
+      /* The probes stop on an empty slot. */
+      if (!empty)
+        return 0;
+    }
+  }
+  if (nb_keywords != header->nb_keywords)
+    return 0;
+  if (root)
+    for (size_t a = 0; a < 256; a++)
+      if (root[a] >= n || (root[a] && cold[root[a]].depth != 1))
+        return 0;
+  return 1;
+}
+
+/* Maps a file written by ACM_save in memory. */
+/* Returns 0 if it is not a file of the current version, written on a compatible host for symbols of the given type. */
+static const struct _ac_file_header *
+__file_map__ (const char *path, const char *symbol, size_t symbol_size, size_t *length)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (!fstat (fd, &st) && (uint64_t) st.st_size >= sizeof (struct _ac_file_header))
+    map = mmap (0, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  /* The mapping is kept after the file is closed. */
+  close (fd);
+  if (map == MAP_FAILED)
+    return 0;
+  const struct _ac_file_header *header = map;
+  uint64_t n = header->nb_states;
+  if (memcmp (header->magic, ACM_FILE_MAGIC, sizeof (header->magic)) || header->version != ACM_FILE_VERSION ||
+      header->byte_order != ACM_FILE_BYTE_ORDER || header->word_size != sizeof (size_t) ||
+      header->symbol_size != symbol_size || strncmp (header->symbol, symbol, sizeof (header->symbol)) ||
+      header->length != (uint64_t) st.st_size || !n ||
+      !__file_section_fits__ (header->hot, n * 4 * sizeof (uint32_t), header->length) ||
+      !__file_section_fits__ (header->edge_letter, (n - 1) * symbol_size, header->length) ||
+      !__file_section_fits__ (header->edge_target, (n - 1) * sizeof (uint32_t), header->length) ||
+      !__file_section_fits__ (header->cold, n * sizeof (struct _ac_mapped_state), header->length) ||
+      (header->root && !__file_section_fits__ (header->root, 256 * sizeof (uint32_t), header->length)) ||
+      (header->hash_offset && !__file_section_fits__ (header->hash_offset, n * sizeof (uint32_t), header->length)) ||
+      (header->hash_table &&
+       !__file_section_fits__ (header->hash_table, header->nb_hash_slots * sizeof (uint32_t), header->length)) ||
+      header->nb_hash_slots > UINT32_MAX || header->pool_length > header->length || header->rank > header->length ||
+      (header->pool &&
+       (!__file_section_fits__ (header->pool, header->pool_length * symbol_size, header->length) ||
+        !__file_section_fits__ (header->pool_offset, header->rank * sizeof (size_t), header->length))) ||
+      !__file_check__ (map, header))
+  {
+    munmap (map, (size_t) st.st_size);
+    return 0;
+  }
+  *length = (size_t) st.st_size;
+  return header;
+}
+
 static char *
 __str_copy__ (const char *v)
 {
@@ -159,6 +559,52 @@ __eqstring (const char * const a, const char * const b)
   default:            EQ_##ACM_SYMBOL##_DEFAULT                        \
   )
 
+/* Whether the default equality operator compares symbols byte per byte (as EQ_##ACM_SYMBOL##_DEFAULT does). */
+#  define EQ_DEFAULT_IS_BYTEWISE(ACM_SYMBOL) _Generic(*(ACM_SYMBOL *)0, \
+  float:              0,                                               \
+  double:             0,                                               \
+  long double:        0,                                               \
+  char*:              0,                                               \
+  default:            1                                                \
+  )
+
+/* Default equality operator inlined in the searches, for symbols compared byte per byte: */
+/* a single comparison for integer types, which the compiler can unroll and vectorize in the loops over goto arrays. */
+#  define EQ_BYTEWISE(a, b) (!memcmp (&(a), &(b), sizeof (a)))
+
+/* Symbol letter mapped by the normalizer of a machine, if any (see SET_NORMALIZER). */
+#  define NORMALIZE(normalize, letter) ((normalize) ? (normalize) (letter) : (letter))
+
+/* Position of the first byte of text from i equal to one of the nb (1 to 3) bytes of set, length if there is none: */
+/* memchr for a single byte, otherwise 16 bytes compared at once with SSE2 if available. */
+/* The set is the symbols which leave state 0 of a machine (see machine_root_bytes_##ACM_SYMBOL). */
+static size_t
+__root_skip__ (const unsigned char *text, size_t i, size_t length, const unsigned char *set, size_t nb)
+{
+  if (nb == 1)
+  {
+    const unsigned char *p = memchr (text + i, set[0], length - i);
+    return p ? (size_t) (p - text) : length;
+  }
+#  ifdef __SSE2__
+  __m128i b0 = _mm_set1_epi8 ((char) set[0]);
+  __m128i b1 = _mm_set1_epi8 ((char) set[1]);
+  __m128i b2 = _mm_set1_epi8 ((char) set[nb - 1]);
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128 ((const __m128i *) (text + i));
+    int mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, b0), _mm_cmpeq_epi8 (chunk, b1)),
+                                                _mm_cmpeq_epi8 (chunk, b2)));
+    if (mask)
+      return i + (size_t) __builtin_ctz ((unsigned int) mask);
+  }
+#  endif
+  for (; i < length; i++)
+    if (text[i] == set[0] || text[i] == set[1] || text[i] == set[nb - 1])
+      return i;
+  return length;
+}
+
 #  define COPY_DEFAULT(ACM_SYMBOL)                                     \
   _Generic(*(ACM_SYMBOL*)0, char*:__str_copy__, default:(COPY_##ACM_SYMBOL##_TYPE)0)
 
@@ -171,6 +617,10 @@ __eqstring (const char * const a, const char * const b)
 static ACM_SYMBOL (*COPY_##ACM_SYMBOL) (const ACM_SYMBOL) = 0;         \
 static void (*DESTROY_##ACM_SYMBOL) (const ACM_SYMBOL) = 0;            \
 static int (*EQ_##ACM_SYMBOL) (const ACM_SYMBOL, const ACM_SYMBOL) = 0;\
+static int (*LT_##ACM_SYMBOL) (const ACM_SYMBOL, const ACM_SYMBOL) = 0;\
+static size_t (*HASH_##ACM_SYMBOL) (const ACM_SYMBOL) = 0;             \
+static ACM_SYMBOL (*NORM_##ACM_SYMBOL) (const ACM_SYMBOL) = 0;         \
+static int (*WORD_##ACM_SYMBOL) (const ACM_SYMBOL) = 0;                \
 \
 static void                                                            \
 __DTOR_##ACM_SYMBOL(const ACM_SYMBOL letter)                           \
@@ -215,31 +665,336 @@ static int __EQ_##ACM_SYMBOL(const ACM_SYMBOL a, const ACM_SYMBOL b)   \
                                        "ABORT  " "\n"), fflush (0), raise (SIGABRT));                       \
 }                                                                      \
 \
+/* Whether eq is the default equality operator comparing symbols byte per byte (see EQ_BYTEWISE). */\
+/* This is known at compile time for the types of symbols compared otherwise. */\
+static int                                                             \
+__EQ_IS_BYTEWISE_##ACM_SYMBOL (EQ_##ACM_SYMBOL##_TYPE eq)              \
+{                                                                      \
+  return EQ_DEFAULT_IS_BYTEWISE (ACM_SYMBOL) && eq == __EQ_##ACM_SYMBOL && !EQ_##ACM_SYMBOL; \
+}                                                                      \
+\
+/* FNV-1a hash of the bytes of a symbol, consistent with a byte per byte equality operator. */\
+static size_t                                                          \
+__HASH_##ACM_SYMBOL (const ACM_SYMBOL letter)                          \
+{                                                                      \
+  const unsigned char *p = (const unsigned char *) &letter;            \
+  uint64_t h = UINT64_C (14695981039346656037);                        \
+  for (size_t i = 0; i < sizeof (ACM_SYMBOL); i++)                     \
+    h = (h ^ p[i]) * UINT64_C (1099511628211);                         \
+  return (size_t) h;                                                   \
+}                                                                      \
+/* Hash of a symbol by the hash operator of a machine: the default one is inlined (as EQ_BYTEWISE). */\
+static inline size_t                                                   \
+symbol_hash_##ACM_SYMBOL (HASH_##ACM_SYMBOL##_TYPE hash, ACM_SYMBOL letter) \
+{                                                                      \
+  return hash == __HASH_##ACM_SYMBOL ? __HASH_##ACM_SYMBOL (letter) : hash (letter); \
+}                                                                      \
+/* The transitions of a state with at least ACM_HASH_MIN_FANOUT transitions are indexed by a hash table (see SET_HASH_OPERATOR): */\
+/* an open addressing table of the positions + 1 of the symbols in goto_array (0 for an empty slot), of size __hash_mask__ (nb_goto) + 1. */\
+/* Size class of the hash table of a state with nb_goto transitions in the arena of the machine, 0 if it has none. */\
+static size_t                                                          \
+goto_hash_class_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, size_t nb_goto) \
+{                                                                      \
+  if (!machine->hash || nb_goto < ACM_HASH_MIN_FANOUT)                 \
+    return 0;                                                          \
+  size_t k = 0;                                                        \
+  for (size_t mask = __hash_mask__ (nb_goto); mask; mask >>= 1)        \
+    k++;                                                               \
+  return ACM_ARENA_HASH_CLASS + k;                                     \
+}                                                                      \
+/* Updates the hash table of a state after the insertion (or the removal) of the symbol at position i of goto_array. */\
+/* An insertion shifts the positions after i, the table is rebuilt on removal or when its size changes. */\
+static void                                                            \
+state_goto_hash_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, ACState_##ACM_SYMBOL * state, size_t i, \
+                                     int inserted)                     \
+{                                                                      \
+  size_t from = goto_hash_class_##ACM_SYMBOL (machine, inserted ? state->nb_goto - 1 : state->nb_goto + 1); \
+  size_t to = goto_hash_class_##ACM_SYMBOL (machine, state->nb_goto);  \
+  if (from != to)                                                      \
+  {                                                                    \
+    if (from)                                                          \
+      __arena_free__ (&machine->arena, state->goto_hash, from);        \
+    state->goto_hash = to ? __arena_alloc__ (&machine->arena, sizeof (*state->goto_hash) << (to - ACM_ARENA_HASH_CLASS), to) : 0; \
+  }                                                                    \
+  if (!to)                                                             \
+    return;                                                            \
+  size_t mask = __hash_mask__ (state->nb_goto);                        \
+  size_t begin = 0, end = state->nb_goto;                              \
+  if (from == to && inserted)                                          \
+  {                                                                    \
+    if (i + 1 < state->nb_goto)                                        \
+      for (size_t h = 0; h <= mask; h++)                               \
+        if (state->goto_hash[h] > i)                                   \
+          state->goto_hash[h]++;                                       \
+    begin = i;                                                         \
+    end = i + 1;                                                       \
+  }                                                                    \
+  else                                                                 \
+    memset (state->goto_hash, 0, sizeof (*state->goto_hash) * (mask + 1)); \
+  for (size_t p = begin; p < end; p++)                                 \
+  {                                                                    \
+    size_t h = symbol_hash_##ACM_SYMBOL (machine->hash, state->goto_array[p].letter) & mask; \
+    while (state->goto_hash[h])                                        \
+      h = (h + 1) & mask;                                              \
+    state->goto_hash[h] = p + 1;                                       \
+  }                                                                    \
+}                                                                      \
+\
+/* Position of the first symbol of goto_array which is not lower than letter (goto_array is sorted if lt is defined). */\
+static struct _ac_next_##ACM_SYMBOL *                                  \
+state_lower_bound_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, ACM_SYMBOL letter, \
+                                LT_##ACM_SYMBOL##_TYPE lt)             \
+{                                                                      \
+  size_t low = 0, high = state->nb_goto;                               \
+  while (low < high)                                                   \
+  {                                                                    \
+    size_t middle = low + (high - low) / 2;                            \
+    if (lt (state->goto_array[middle].letter, letter))                 \
+      low = middle + 1;                                                \
+    else                                                               \
+      high = middle;                                                   \
+  }                                                                    \
+  return state->goto_array + low;                                      \
+}                                                                      \
+/* Size class of a goto array of nb_goto transitions in the arena of the machine: */\
+/* 0 if empty, k if its capacity is 2^(k-1) (size class 0 is used by states). */\
+static size_t                                                          \
+goto_array_class_##ACM_SYMBOL (size_t nb_goto)                         \
+{                                                                      \
+  size_t k = 0;                                                        \
+  if (nb_goto)                                                         \
+    for (k = 1; ((size_t) 1 << (k - 1)) < nb_goto; k++)                \
+      /* nothing */ ;                                                  \
+  return k;                                                            \
+}                                                                      \
+/* Resizes the goto array of a state to nb_goto transitions, keeping the first ones. */\
+/* The array is moved to another block of the arena only when its capacity changes. */\
+static void                                                            \
+state_goto_array_resize_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, ACState_##ACM_SYMBOL * state, \
+                                      size_t nb_goto)                  \
+{                                                                      \
+  size_t from = goto_array_class_##ACM_SYMBOL (state->nb_goto);        \
+  size_t to = goto_array_class_##ACM_SYMBOL (nb_goto);                 \
+  if (from != to)                                                      \
+  {                                                                    \
+    struct _ac_next_##ACM_SYMBOL *goto_array = 0;                      \
+    if (to)                                                            \
+    {                                                                  \
+      goto_array = __arena_alloc__ (&machine->arena, sizeof (*goto_array) << (to - 1), to); \
+      if (state->nb_goto)                                              \
+        memcpy (goto_array, state->goto_array,                         \
+                sizeof (*goto_array) * (nb_goto < state->nb_goto ? nb_goto : state->nb_goto)); \
+    }                                                                  \
+    if (from)                                                          \
+      __arena_free__ (&machine->arena, state->goto_array, from);       \
+    state->goto_array = goto_array;                                    \
+  }                                                                    \
+  state->nb_goto = nb_goto;                                            \
+}                                                                      \
+/* Returns g(state, letter), or 0 if g(state, letter) = fail. */       \
+static ACState_##ACM_SYMBOL *                                          \
+state_next_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, ACM_SYMBOL letter, \
+                         EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt) \
+{                                                                      \
+  struct _ac_next_##ACM_SYMBOL *p;                                     \
+  struct _ac_next_##ACM_SYMBOL *end = state->goto_array + state->nb_goto; \
+  int bytewise = __EQ_IS_BYTEWISE_##ACM_SYMBOL (eq);                   \
+  if (state->goto_hash)   /* Hash table */                             \
+  {                                                                    \
+    size_t mask = __hash_mask__ (state->nb_goto);                      \
+    for (size_t h = symbol_hash_##ACM_SYMBOL (state->machine->hash, letter) & mask; state->goto_hash[h]; \
+         h = (h + 1) & mask)                                           \
+    {                                                                  \
+      p = state->goto_array + state->goto_hash[h] - 1;                 \
+      if (bytewise ? EQ_BYTEWISE (p->letter, letter) : eq (p->letter, letter)) \
+        return p->state;                                               \
+    }                                                                  \
+    return 0;                                                          \
+  }                                                                    \
+  if (lt)   /* Binary search */                                        \
+    return (p = state_lower_bound_##ACM_SYMBOL (state, letter, lt)) < end && \
+      (bytewise ? EQ_BYTEWISE (p->letter, letter) : eq (p->letter, letter)) ? p->state : 0; \
+  if (bytewise)                                                        \
+  {                                                                    \
+    for (p = state->goto_array; p < end; p++)                          \
+      if (EQ_BYTEWISE (p->letter, letter))                             \
+        return p->state;                                               \
+  }                                                                    \
+  else                                                                 \
+    for (p = state->goto_array; p < end; p++)                          \
+      if (eq (p->letter, letter))                                      \
+        return p->state;                                               \
+  return 0;                                                            \
+}                                                                      \
+\
+\
 static const ACState_##ACM_SYMBOL *state_goto_##ACM_SYMBOL (           \
-                const ACState_##ACM_SYMBOL * state,                    \
-                ACM_SYMBOL letter, EQ_##ACM_SYMBOL##_TYPE eq);         \
+                const ACState_##ACM_SYMBOL * state, ACM_SYMBOL letter, \
+                EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt); \
+\
+static void                                                            \
+machine_root_index_clear_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  free (machine->root_transition);                                     \
+  machine->root_transition = 0;                                        \
+  machine->nb_root_bytes = 0;                                          \
+}                                                                      \
+/* Collects the symbols a of one byte of a text for which g(0, a) != fail, once normalized, */\
+/* so that the searches can skip to the next of them while at state 0 (see __root_skip__). */\
+/* The skip is disabled (nb_root_bytes = 0) if there are more than 3 of them, for it would hardly skip anything. */\
+static void                                                            \
+machine_root_bytes_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)     \
+{                                                                      \
+  machine->nb_root_bytes = 0;                                          \
+  const uint32_t *flat_root = machine->flat ? machine->flat->root : 0; \
+  if (sizeof (ACM_SYMBOL) != 1 || (!machine->root_transition && !flat_root)) \
+    return;                                                            \
+  for (size_t a = 0; a < 256; a++)                                     \
+  {                                                                    \
+    ACM_SYMBOL letter;                                                 \
+    unsigned char byte = (unsigned char) a;                            \
+    memcpy (&letter, &byte, 1);                                        \
+    letter = NORMALIZE (machine->normalize, letter);                   \
+    byte = *(const unsigned char *) &letter;                           \
+    if (machine->root_transition ? machine->root_transition[byte] == machine->state_0 : !flat_root[byte]) \
+      continue;                                                        \
+    if (machine->nb_root_bytes == sizeof (machine->root_byte))         \
+    {                                                                  \
+      machine->nb_root_bytes = 0;                                      \
+      return;                                                          \
+    }                                                                  \
+    machine->root_byte[machine->nb_root_bytes++] = (unsigned char) a;  \
+  }                                                                    \
+}                                                                      \
+/* Indexes the transitions of state 0 for state_goto, since most symbols of a text fall back to state 0: */\
+/* for symbols of one byte, a direct table of 256 transitions g(0, a), or 0 if g(0, a) = fail (property LOOP_0). */\
+/* (The transitions of state 0 of larger symbols are indexed by its hash table, see state_goto_hash_update.) */\
+static void                                                            \
+machine_root_index_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)     \
+{                                                                      \
+  ACState_##ACM_SYMBOL *state_0 = machine->state_0; /* [state 0] */    \
+  machine_root_index_clear_##ACM_SYMBOL (machine);                     \
+  if (sizeof (ACM_SYMBOL) == 1)                                        \
+  {                                                                    \
+    ACM_ASSERT (machine->root_transition = malloc (sizeof (*machine->root_transition) * 256)); \
+    for (size_t a = 0; a < 256; a++)                                   \
+    {                                                                  \
+      ACM_SYMBOL letter;                                               \
+      unsigned char byte = (unsigned char) a;                          \
+      memcpy (&letter, &byte, 1);                                      \
+      const ACState_##ACM_SYMBOL *next = state_next_##ACM_SYMBOL (state_0, letter, machine->eq, machine->lt); \
+      machine->root_transition[a] = next ? next : state_0;             \
+    }                                                                  \
+  }                                                                    \
+  machine_root_bytes_##ACM_SYMBOL (machine);                           \
+}                                                                      \
+\
+/* The inverse of the failure function is kept as a tree, rooted at state 0: */\
+/* the children of a state r are the states s such that f(s) = r. */   \
+static void                                                            \
+state_fail_tree_link_##ACM_SYMBOL (ACState_##ACM_SYMBOL * s, const ACState_##ACM_SYMBOL * fail) \
+{                                                                      \
+  ACState_##ACM_SYMBOL *r = (ACState_##ACM_SYMBOL *) fail;             \
+  s->fail_state = r;                                                   \
+  s->fail_tree.previous_sibling = 0;                                   \
+  s->fail_tree.next_sibling = r->fail_tree.first_child;                \
+  if (r->fail_tree.first_child)                                        \
+    r->fail_tree.first_child->fail_tree.previous_sibling = s;          \
+  r->fail_tree.first_child = s;                                        \
+}                                                                      \
 \
 static void                                                            \
-state_reset_output_##ACM_SYMBOL (ACState_##ACM_SYMBOL * r)             \
+state_fail_tree_unlink_##ACM_SYMBOL (ACState_##ACM_SYMBOL * s)         \
 {                                                                      \
-  if (r->is_matching)                                                  \
-    r->nb_sequence = 1; /* Reset to original output (as in state_goto_update) */\
+  if (s->fail_tree.previous_sibling)                                   \
+    s->fail_tree.previous_sibling->fail_tree.next_sibling = s->fail_tree.next_sibling; \
   else                                                                 \
-    r->nb_sequence = 0;                                                \
-  struct _ac_next_##ACM_SYMBOL *p = r->goto_array;                     \
-  struct _ac_next_##ACM_SYMBOL *end = p + r->nb_goto;                  \
-  for (; p < end; p++)                                                 \
-    state_reset_output_##ACM_SYMBOL (p->state);                        \
+    ((ACState_##ACM_SYMBOL *) s->fail_state)->fail_tree.first_child = s->fail_tree.next_sibling; \
+  if (s->fail_tree.next_sibling)                                       \
+    s->fail_tree.next_sibling->fail_tree.previous_sibling = s->fail_tree.previous_sibling; \
+}                                                                      \
+/* Aho-Corasick Algorithm 3: f(s) and output (s) for a state s = g(r, a), where r != 0 and f(r) is known. */\
+static void                                                            \
+state_fail_state_set_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, ACState_##ACM_SYMBOL * s) \
+{                                                                      \
+  const ACState_##ACM_SYMBOL *r = s->previous.state;                   \
+  ACM_SYMBOL a = r->goto_array[s->previous.i_letter].letter;           \
+  /* Aho-Corasick Algorithm 3: state <- f(r) */                        \
+  const ACState_##ACM_SYMBOL *state = r->fail_state; /* f(r) */        \
+  /* Aho-Corasick Algorithm 3: while g(state, a) = fail [and state != 0] do state <- f(state)        [2] */\
+  /*                           [if g(state, a) != fail then] f(s) <- g(state, a) [else f(s) <- 0]    [3] */\
+  s->fail_state /* f(s) */ = state_goto_##ACM_SYMBOL (state, a, machine->eq, machine->lt); \
+  /* Aho-Corasick Algorithm 3: output (s) <-output (s) U output (f(s)) */\
+  /* f(s) is closer to state 0 than s, and its output is already complete. */\
+  s->nb_sequence = (s->is_matching ? 1 : 0) + s->fail_state->nb_sequence; \
+  /* output (f(s)) is kept as a link to the first matching state in the chain of failure states of s. */\
+  s->output_state = s->fail_state->is_matching ? s->fail_state : s->fail_state->output_state; \
+}                                                                      \
+\
+/* A part of a level of the machine, processed by a thread of state_fail_state_level. */\
+struct _ac_fail_part_##ACM_SYMBOL                                      \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine;                               \
+  ACState_##ACM_SYMBOL **states;                                       \
+  size_t nb_states;                                                    \
+};                                                                     \
+\
+static void *                                                          \
+state_fail_state_part_##ACM_SYMBOL (void *arg)                         \
+{                                                                      \
+  struct _ac_fail_part_##ACM_SYMBOL *part = arg;                       \
+  for (size_t i = 0; i < part->nb_states; i++)                         \
+    state_fail_state_set_##ACM_SYMBOL (part->machine, part->states[i]); \
+  return 0;                                                            \
+}                                                                      \
+/* f(s) and output (s) for all the states s of a level (of same depth > 1). */\
+/* They only depend on the states of the previous levels: a large level is shared between machine->nb_build_threads threads. */\
+static void                                                            \
+state_fail_state_level_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, ACState_##ACM_SYMBOL ** states, \
+                                     size_t nb_states)                 \
+{                                                                      \
+  size_t nb_threads = machine->nb_build_threads;                       \
+  if (nb_threads > nb_states / ACM_MIN_STATES_PER_THREAD)              \
+    nb_threads = nb_states / ACM_MIN_STATES_PER_THREAD;                \
+  if (nb_threads <= 1)                                                 \
+  {                                                                    \
+    struct _ac_fail_part_##ACM_SYMBOL part = { machine, states, nb_states }; \
+    state_fail_state_part_##ACM_SYMBOL (&part);                        \
+    return;                                                            \
+  }                                                                    \
+  struct _ac_fail_part_##ACM_SYMBOL *parts = malloc (sizeof (*parts) * nb_threads); \
+  pthread_t *threads = malloc (sizeof (*threads) * nb_threads);        \
+  int *started = malloc (sizeof (*started) * nb_threads);              \
+  ACM_ASSERT (parts && threads && started);                            \
+  for (size_t t = 0; t < nb_threads; t++)                              \
+  {                                                                    \
+    parts[t].machine = machine;                                        \
+    parts[t].states = states + t * nb_states / nb_threads;             \
+    parts[t].nb_states = (t + 1) * nb_states / nb_threads - t * nb_states / nb_threads; \
+    /* The first part is processed by the calling thread, as well as those for which no thread could be created. */\
+    started[t] = t && !pthread_create (threads + t, 0, state_fail_state_part_##ACM_SYMBOL, parts + t); \
+  }                                                                    \
+  for (size_t t = 0; t < nb_threads; t++)                              \
+    if (started[t])                                                    \
+      pthread_join (threads[t], 0);                                    \
+    else                                                               \
+      state_fail_state_part_##ACM_SYMBOL (parts + t);                  \
+  free (started);                                                      \
+  free (threads);                                                      \
+  free (parts);                                                        \
 }                                                                      \
 /* Aho-Corasick Algorithm 3: construction of the failure function. */  \
+/* The outputs of the states are reset to their original output (as in machine_goto_update) when they are queued, */\
+/* so that the failure function can be reconstructed in a single traversal of the machine. */\
 static void                                                            \
 state_fail_state_construct_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
 {                                                                      \
   ACState_##ACM_SYMBOL *state_0 = machine->state_0; /* [state 0] */    \
-  if (machine->reconstruct == 2)                                       \
-    state_reset_output_##ACM_SYMBOL (state_0);                         \
+  /* The index of state 0 only depends on the goto function, and speeds up state_goto during the construction. */\
+  machine_root_index_##ACM_SYMBOL (machine);                           \
   /* Aho-Corasick Algorithm: "(except state 0 for which the failure function is not defined)." */\
   state_0->fail_state = 0;                                             \
+  state_0->fail_tree.first_child = 0;                                  \
   /* Aho-Corasick Algorithm 3: queue <- empty */                       \
   /* The first element in the queue will not be processed, therefore it can be added harmlessly. */\
   size_t queue_length = 0;                                             \
@@ -255,54 +1010,152 @@ state_fail_state_construct_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
     queue_length++;                                                    \
     queue[queue_length - 1] = s; /* s */                               \
     /* Aho-Corasick Algorithm 3: f(s) <- 0 */                          \
-    s->fail_state = state_0;                                           \
+    s->fail_tree.first_child = 0;                                      \
+    state_fail_tree_link_##ACM_SYMBOL (s, state_0);                    \
+    s->nb_sequence = s->is_matching ? 1 : 0;                           \
+    /* Output state 0 is empty (empty keywords are not registered) */  \
+    s->output_state = 0;                                               \
   }   /* loop on state_0->goto_array */                                \
   size_t queue_read_pos = 0;                                           \
   /* Aho-Corasick Algorithm 3: while queue != empty do */              \
+  /* The queue is processed one level at a time: all the states r of a level are removed from the queue, */\
+  /* and the states s of the next level are appended to the queue, before f(s) is computed for all of them. */\
   while (queue_read_pos < queue_length)                                \
   {                                                                    \
-    /* Aho-Corasick Algorithm 3: let r be the next state in queue */   \
-    ACState_##ACM_SYMBOL *r = queue[queue_read_pos];                   \
-    /* Aho-Corasick Algorithm 3: queue <- queue - {r} */               \
-    queue_read_pos++;                                                  \
-    /* Aho-Corasick Algorithm 3: for each a such that s != fail, where s <- g(r, a) */\
-    struct _ac_next_##ACM_SYMBOL *p = r->goto_array;                   \
-    struct _ac_next_##ACM_SYMBOL *end = p + r->nb_goto;                \
-    for (; p < end; p++)                   /* loop on r->goto_array */ \
+    size_t level = queue_length;                                       \
+    for (; queue_read_pos < level; queue_read_pos++)                   \
     {                                                                  \
-      ACState_##ACM_SYMBOL *s = p->state; /* [s <- g(r, a)] */         \
-      ACM_SYMBOL a = p->letter;                                        \
-      /* Aho-Corasick Algorithm 3: queue <- queue U {s} */             \
-      queue_length++;                                                  \
-      queue[queue_length - 1] = s;                                     \
-      /* Aho-Corasick Algorithm 3: state <- f(r) */                    \
-      const ACState_##ACM_SYMBOL *state = r->fail_state; /* f(r) */    \
-      /* Aho-Corasick Algorithm 3: while g(state, a) = fail [and state != 0] do state <- f(state)        [2] */\
-      /*                           [if g(state, a) != fail then] f(s) <- g(state, a) [else f(s) <- 0]    [3] */\
-      s->fail_state /* f(s) */ = state_goto_##ACM_SYMBOL (state, a, machine->eq); \
-      /* Aho-Corasick Algorithm 3: output (s) <-output (s) U output (f(s)) */\
-      s->nb_sequence += s->fail_state->nb_sequence;                    \
-    }   /* loop on r->goto_array */                                    \
+      /* Aho-Corasick Algorithm 3: let r be the next state in queue */ \
+      /* Aho-Corasick Algorithm 3: queue <- queue - {r} */             \
+      ACState_##ACM_SYMBOL *r = queue[queue_read_pos];                 \
+      /* Aho-Corasick Algorithm 3: for each a such that s != fail, where s <- g(r, a) */\
+      struct _ac_next_##ACM_SYMBOL *p = r->goto_array;                 \
+      struct _ac_next_##ACM_SYMBOL *end = p + r->nb_goto;              \
+      for (; p < end; p++)                 /* loop on r->goto_array */ \
+        /* Aho-Corasick Algorithm 3: queue <- queue U {s} */           \
+        queue[queue_length++] = p->state; /* [s <- g(r, a)] */         \
+    }                                                                  \
+    state_fail_state_level_##ACM_SYMBOL (machine, queue + level, queue_length - level); \
+    /* The tree of the inverse failure function is linked by the calling thread only. */\
+    for (size_t i = level; i < queue_length; i++)                      \
+    {                                                                  \
+      queue[i]->fail_tree.first_child = 0;                             \
+      state_fail_tree_link_##ACM_SYMBOL (queue[i], queue[i]->fail_state); \
+    }                                                                  \
   }   /* while (queue_read_pos < queue_length) */                      \
   free (queue);                                                        \
-  machine->reconstruct = 0;                                            \
+  /* Publishes the failure function to the threads reading reconstruct without the lock. */\
+  __atomic_store_n (&machine->reconstruct, 0, __ATOMIC_RELEASE);       \
+}                                                                      \
+/* Builds the failure function if needed, once for all concurrent threads. */\
+static void                                                            \
+machine_fail_state_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  /* Double-checked locking */                                         \
+  if (__atomic_load_n (&machine->reconstruct, __ATOMIC_ACQUIRE))       \
+  {                                                                    \
+    pthread_mutex_lock (&machine->lock);                               \
+    if (machine->reconstruct)                                          \
+      state_fail_state_construct_##ACM_SYMBOL (machine);               \
+    pthread_mutex_unlock (&machine->lock);                             \
+  }                                                                    \
+}                                                                      \
+\
+/* Collects the states g(u, a), for the states u of the subtree of the tree of the inverse failure function rooted at u, */\
+/* which are shorter than s and should fail to s (see state_fail_state_insert). */\
+static void                                                            \
+state_fail_state_redirect_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, const ACState_##ACM_SYMBOL * u, \
+                                        ACM_SYMBOL a, const ACState_##ACM_SYMBOL * s, \
+                                        ACState_##ACM_SYMBOL *** redirected, size_t * nb_redirected) \
+{                                                                      \
+  ACState_##ACM_SYMBOL *t = state_next_##ACM_SYMBOL (u, a, machine->eq, machine->lt); \
+  if (t)                                                               \
+  {                                                                    \
+    if (t->fail_state->depth < s->depth)                               \
+    {                                                                  \
+      /* The capacity of the array is doubled when it is full (it is a power of 2). */\
+      if (!(*nb_redirected & (*nb_redirected - 1)))                    \
+        ACM_ASSERT (*redirected = realloc (*redirected, sizeof (**redirected) * (*nb_redirected ? 2 * *nb_redirected : 1))); \
+      (*redirected)[(*nb_redirected)++] = t;                           \
+    }                                                                  \
+    /* The states g(v, a) below u fail to t, or to a longer state than t. */\
+    return;                                                            \
+  }                                                                    \
+  for (const ACState_##ACM_SYMBOL * v = u->fail_tree.first_child; v; v = v->fail_tree.next_sibling) \
+    state_fail_state_redirect_##ACM_SYMBOL (machine, v, a, s, redirected, nb_redirected); \
+}                                                                      \
+/* Incremental Aho-Corasick Algorithm 3: failure function of a new state s = g(r, a) (not matching yet), */\
+/* where the failure function of r is already up to date. */          \
+static void                                                            \
+state_fail_state_insert_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, ACState_##ACM_SYMBOL * s) \
+{                                                                      \
+  ACState_##ACM_SYMBOL *r = s->previous.state;                         \
+  ACM_SYMBOL a = r->goto_array[s->previous.i_letter].letter;           \
+  /* Aho-Corasick Algorithm 3: f(s) <- g(state, a), where state is the first state in the chain of failure states of r */\
+  /*                           for which g(state, a) != fail, or 0 if r = 0 */\
+  const ACState_##ACM_SYMBOL *fail = r == machine->state_0 ? r :      \
+    state_goto_##ACM_SYMBOL (r->fail_state, a, machine->eq, machine->lt); \
+  /* The states t = g(u, a), where the chain of failure states of u goes through r, now fail to s */\
+  /* if f(t) was shorter than s. Their outputs are unchanged, as s does not match. */\
+  /* N.B.: for r = 0, every state is in the subtree of r: the search is then O(size of the machine). */\
+  /* They are collected before s is linked to f(s), which can be r. */\
+  ACState_##ACM_SYMBOL **redirected = 0;                               \
+  size_t nb_redirected = 0;                                            \
+  for (const ACState_##ACM_SYMBOL * u = r->fail_tree.first_child; u; u = u->fail_tree.next_sibling) \
+    state_fail_state_redirect_##ACM_SYMBOL (machine, u, a, s, &redirected, &nb_redirected); \
+  s->fail_tree.first_child = 0;                                        \
+  state_fail_tree_link_##ACM_SYMBOL (s, fail);                         \
+  /* Aho-Corasick Algorithm 3: output (s) <- output (f(s)) */         \
+  s->nb_sequence = s->fail_state->nb_sequence;                         \
+  s->output_state = s->fail_state->is_matching ? s->fail_state : s->fail_state->output_state; \
+  for (size_t i = 0; i < nb_redirected; i++)                           \
+  {                                                                    \
+    state_fail_tree_unlink_##ACM_SYMBOL (redirected[i]);               \
+    state_fail_tree_link_##ACM_SYMBOL (redirected[i], s);              \
+  }                                                                    \
+  free (redirected);                                                   \
+}                                                                      \
+/* Adds (if add != 0) or removes the output of the state m to or from the outputs of the states */\
+/* whose chain of failure states goes through m, i.e. the subtree rooted at m of the tree of the inverse failure function. */\
+static void                                                            \
+state_output_update_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * r, const ACState_##ACM_SYMBOL * m, int add) \
+{                                                                      \
+  for (ACState_##ACM_SYMBOL * t = r->fail_tree.first_child; t; t = t->fail_tree.next_sibling) \
+  {                                                                    \
+    if (add)                                                           \
+      t->nb_sequence++;                                                \
+    else                                                               \
+      t->nb_sequence--;                                                \
+    /* output (t) is linked to m unless a matching state stands between t and m in the chain of failure states. */\
+    if (add && t->output_state == m->output_state)                     \
+      t->output_state = m;                                             \
+    else if (!add && t->output_state == m)                             \
+      t->output_state = m->output_state;                               \
+    state_output_update_##ACM_SYMBOL (t, m, add);                      \
+  }                                                                    \
 }                                                                      \
 \
 static const ACState_##ACM_SYMBOL *                                    \
 state_goto_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, ACM_SYMBOL letter /* a[i] */,\
-                         EQ_##ACM_SYMBOL##_TYPE eq)                    \
+                         EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt) \
 {                                                                      \
   /* Aho-Corasick Algorithm 1: while g(state, a[i]) = fail [and state != 0] do state <- f(state)           [2] */\
   /*                           [if g(state, a[i]) != fail then] state <- g(state, a[i]) [else state <- 0]  [3] */\
   /*                           [The function returns state] */         \
   while (1)                                                            \
   {                                                                    \
+    /* After Algorithm 3 has been processed, the only state for which f(state) = 0 is state 0. */\
+    if (!state->fail_state)                                            \
+    {                                                                  \
+      const ACMachine_##ACM_SYMBOL *machine = state->machine;          \
+      /* [return g(0, a[i]) if g(0, a[i]) != fail, 0 otherwise], in one load */\
+      if (machine->root_transition)                                    \
+        return machine->root_transition[*(const unsigned char *) &letter]; \
+    }                                                                  \
     /* [if g(state, a[i]) != fail then return g(state, a[i])] */       \
-    struct _ac_next_##ACM_SYMBOL *p = state->goto_array;               \
-    struct _ac_next_##ACM_SYMBOL *end = p + state->nb_goto;            \
-    for (; p < end; p++)                                               \
-      if (eq (p->letter, letter))                                      \
-        return p->state;                                               \
+    const ACState_##ACM_SYMBOL *next = state_next_##ACM_SYMBOL (state, letter, eq, lt); \
+    if (next)                                                          \
+      return next;                                                     \
     /* From here, [g(state, a[i]) = fail] */                           \
                                                                        \
     /* Algorithms 1 cannot consider that g(0, a) never fails because propoerty LOOP_0 has not been implemented. */\
@@ -320,6 +1173,16 @@ state_goto_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, ACM_SYMBOL letter /
   }                                                                    \
 }                                                                      \
 /* Aho-Corasick Algorithm 1: Pattern matching machine - if output (state) != empty */\
+/* Matching on a frozen machine (see ACM_build): the failure function is known to be up to date. */\
+static size_t                                                          \
+ACM_match_frozen_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, ACM_SYMBOL letter) \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine = (*pstate)->machine;          \
+  return                                                               \
+    (*pstate = state_goto_##ACM_SYMBOL (*pstate, NORMALIZE (machine->normalize, letter), machine->eq, machine->lt)) \
+      ->nb_sequence;                                                   \
+}                                                                      \
+\
 static size_t                                                          \
 ACM_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, ACM_SYMBOL letter)     \
 {                                                                      \
@@ -329,35 +1192,116 @@ ACM_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, ACM_SYMBOL letter)
   /*       i.e. if a keyword has been added since the last pattern maching search. */\
   /*       Therefore, algorithms 2 and 3 can be processed alternately. */\
   /*       (algorithm 3 will traverse the full goto graph after a keyword has been added.) */\
-  /* Double-checked locking */                                         \
-  ACMachine_##ACM_SYMBOL * machine = (*pstate)->machine;               \
-  if (machine->reconstruct)                                            \
-  {                                                                    \
-    pthread_mutex_lock (&machine->lock);                               \
-    if (machine->reconstruct)                                          \
-      state_fail_state_construct_##ACM_SYMBOL (machine);               \
-    pthread_mutex_unlock (&machine->lock);                             \
-  }                                                                    \
-  return                                                               \
-    (*pstate = state_goto_##ACM_SYMBOL (*pstate, letter, machine->eq)) \
-      ->nb_sequence;                                                   \
+  machine_fail_state_update_##ACM_SYMBOL ((*pstate)->machine);         \
+  return ACM_match_frozen_##ACM_SYMBOL (pstate, letter);               \
 }                                                                      \
-/* Aho-Corasick Algorithm 1: Pattern matching machine - print output (state) [ith element] */\
+/* Aho-Corasick Algorithm 1: Pattern matching machine - for i <- 1 until n do */\
 static size_t                                                          \
-ACM_get_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index,  \
-                            MatchHolder_##ACM_SYMBOL * match, void **value)    \
+ACM_match_buffer_frozen_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate,    \
+                                      const ACM_SYMBOL * text, size_t length,  \
+                                      MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context) \
 {                                                                      \
-  /* Aho-Corasick Algorithm 1: if output(state) [ith element] */       \
-  ACM_ASSERT (index < state->nb_sequence);                             \
-  size_t i = 0;                                                        \
-  for (; state; state = state->fail_state, i++ /* skip to the next failing state */ )\
+  EQ_##ACM_SYMBOL##_TYPE eq = (*pstate)->machine->eq;                  \
+  LT_##ACM_SYMBOL##_TYPE lt = (*pstate)->machine->lt;                  \
+  NORM_##ACM_SYMBOL##_TYPE normalize = (*pstate)->machine->normalize;  \
+  const ACMachine_##ACM_SYMBOL *machine = (*pstate)->machine;          \
+  const ACState_##ACM_SYMBOL *state = *pstate;                         \
+  size_t nb = 0;                                                       \
+  for (size_t i = 0; i < length; i++)                                  \
   {                                                                    \
-    /* Look for the first state in the "failing states" chain which matches a keyword. */\
-    while (!state->is_matching && state->fail_state)                   \
-      state = state->fail_state;                                       \
-    if (i == index)                                                    \
+    /* The symbols which do not leave state 0 are skipped at once (see machine_root_bytes). */\
+    if (state == machine->state_0 && machine->nb_root_bytes &&         \
+        (i = __root_skip__ ((const unsigned char *) text, i, length, machine->root_byte, machine->nb_root_bytes)) == length) \
       break;                                                           \
+    /* Aho-Corasick Algorithm 1: if output (state) != empty */         \
+    if ((state = state_goto_##ACM_SYMBOL (state, NORMALIZE (normalize, text[i]), eq, lt))->nb_sequence) \
+    {                                                                  \
+      nb += state->nb_sequence;                                        \
+      if (handler)                                                     \
+        handler (state, i, state->nb_sequence, context);               \
+    }                                                                  \
   }                                                                    \
+  *pstate = state;                                                     \
+  return nb;                                                           \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_match_buffer_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate,   \
+                               const ACM_SYMBOL * text, size_t length, \
+                               MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context) \
+{                                                                      \
+  /* The fail state chains are rebuilt once for the whole text (see ACM_match). */\
+  machine_fail_state_update_##ACM_SYMBOL ((*pstate)->machine);         \
+  return ACM_match_buffer_frozen_##ACM_SYMBOL (pstate, text, length, handler, context); \
+}                                                                      \
+/* Class of a symbol of the keywords in the transition table of a compiled machine (see ACM_compile): */\
+/* the symbol itself for one byte symbols, its position in the alphabet of the machine otherwise, or 0 if it is in none. */\
+static size_t                                                          \
+machine_symbol_class_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, ACM_SYMBOL letter) \
+{                                                                      \
+  if (sizeof (ACM_SYMBOL) == 1)                                        \
+    return *(const unsigned char *) &letter;                           \
+  if (machine->alphabet_hash)                                          \
+    for (size_t h = symbol_hash_##ACM_SYMBOL (machine->hash, letter) & machine->alphabet_hash_mask; machine->alphabet_hash[h]; \
+         h = (h + 1) & machine->alphabet_hash_mask)                    \
+      if (__EQ_IS_BYTEWISE_##ACM_SYMBOL (machine->eq) ? EQ_BYTEWISE (machine->alphabet[machine->alphabet_hash[h]], letter) : \
+          machine->eq (machine->alphabet[machine->alphabet_hash[h]], letter)) \
+        return machine->alphabet_hash[h];                              \
+  return 0;                                                            \
+}                                                                      \
+/* Class of a symbol of a text (the normalizer of one byte symbols is applied in the table itself). */\
+static size_t                                                          \
+machine_text_class_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, ACM_SYMBOL letter) \
+{                                                                      \
+  return machine_symbol_class_##ACM_SYMBOL (machine, sizeof (ACM_SYMBOL) == 1 ? letter : NORMALIZE (machine->normalize, letter)); \
+}                                                                      \
+/* Aho-Corasick Algorithm 1 applied to the deterministic finite automaton built by Algorithm 4 (see ACM_compile). */\
+static size_t                                                          \
+ACM_match_compiled_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, ACM_SYMBOL letter) \
+{                                                                      \
+  /* Aho-Corasick Algorithm 1: state <- delta(state, a[i]) */          \
+  return (*pstate = (*pstate)->transition[machine_text_class_##ACM_SYMBOL ((*pstate)->machine, letter)])->nb_sequence; \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_match_buffer_compiled_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate,  \
+                                        const ACM_SYMBOL * text, size_t length, \
+                                        MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context) \
+{                                                                      \
+  const ACState_##ACM_SYMBOL *state = *pstate;                         \
+  const ACMachine_##ACM_SYMBOL *machine = state->machine;              \
+  size_t nb = 0;                                                       \
+  for (size_t i = 0; i < length; i++)                                  \
+  {                                                                    \
+    /* The symbols which do not leave state 0 are skipped at once (see machine_root_bytes). */\
+    if (state == machine->state_0 && machine->nb_root_bytes &&         \
+        (i = __root_skip__ ((const unsigned char *) text, i, length, machine->root_byte, machine->nb_root_bytes)) == length) \
+      break;                                                           \
+    /* Aho-Corasick Algorithm 1: state <- delta(state, a[i]) */        \
+    if ((state = state->transition[machine_text_class_##ACM_SYMBOL (machine, text[i])])->nb_sequence) \
+    {                                                                  \
+      nb += state->nb_sequence;                                        \
+      if (handler)                                                     \
+        handler (state, i, state->nb_sequence, context);               \
+    }                                                                  \
+  }                                                                    \
+  *pstate = state;                                                     \
+  return nb;                                                           \
+}                                                                      \
+/* Aho-Corasick Algorithm 1: Pattern matching machine - print output (state) [ith element] */\
+static size_t                                                          \
+ACM_get_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index,  \
+                            MatchHolder_##ACM_SYMBOL * match, void **value)    \
+{                                                                      \
+  /* Aho-Corasick Algorithm 1: if output(state) [ith element] */       \
+  ACM_ASSERT (index < state->nb_sequence);                             \
+  /* Look for the first state in the "failing states" chain which matches a keyword. */\
+  if (!state->is_matching)                                             \
+    state = state->output_state;                                       \
+  /* Skip to the next matching state in the chain of failure states, one hop per match. */\
+  size_t i = 0;                                                        \
+  for (; i < index; i++)                                               \
+    state = state->output_state;                                       \
   /* Argument match could be passed to 0 if only value or rank is needed. */\
   if (match)                                                           \
   {                                                                    \
@@ -382,46 +1326,653 @@ ACM_get_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index,  \
     *value = state->value;                                             \
   return state->rank;                                                  \
 }                                                                      \
+/* ACM_get_match without reconstruction of the keyword: it is read in place in the pool of keywords of the machine. */\
+static size_t                                                          \
+ACM_get_match_view_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index, \
+                                 MatchView_##ACM_SYMBOL * view, void **value) \
+{                                                                      \
+  ACM_ASSERT (index < state->nb_sequence);                             \
+  if (!state->is_matching)                                             \
+    state = state->output_state;                                       \
+  for (size_t i = 0; i < index; i++)                                   \
+    state = state->output_state;                                       \
+  const ACMachine_##ACM_SYMBOL *machine = state->machine;              \
+  view->letter = machine->pool ? machine->pool + machine->pool_offset[state->rank] : 0; \
+  view->length = state->depth;                                         \
+  view->rank = state->rank;                                            \
+  if (value)                                                           \
+    *value = state->value;                                             \
+  return state->rank;                                                  \
+}                                                                      \
+/* Aho-Corasick Algorithm 1: Pattern matching machine - print output (state) */\
+static size_t                                                          \
+ACM_foreach_match_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state,    \
+                                void (*operator) (size_t, size_t, void *, void *), \
+                                void *context)                         \
+{                                                                      \
+  size_t nb = 0;                                                       \
+  /* Walk through the matching states of the chain of failure states, one hop per match. */\
+  for (state = state->is_matching ? state : state->output_state; state; state = state->output_state) \
+  {                                                                    \
+    if (operator)                                                      \
+      operator (state->rank, state->depth, state->value, context);     \
+    nb++;                                                              \
+  }                                                                    \
+  return nb;                                                           \
+}                                                                      \
+\
+/* Records of the matches at a position of a text, passed by ACM_match_records through ACM_match_buffer and ACM_foreach_match. */\
+struct _ac_records_##ACM_SYMBOL                                        \
+{                                                                      \
+  MATCH_RECORD_HANDLER_##ACM_SYMBOL##_TYPE handler;                    \
+  void *context;                                                       \
+  size_t offset; /* Position of the text in the stream */              \
+  size_t end;    /* Position following the last matching symbol */     \
+  int mode;      /* ACM_MATCH_ALL, ACM_MATCH_LEFTMOST_LONGEST or ACM_MATCH_LEFTMOST_FIRST */ \
+  WORD_##ACM_SYMBOL##_TYPE is_word; /* Word symbol predicate, for ACM_MATCH_WORDS only */ \
+  const ACM_SYMBOL *text;                                              \
+  size_t length;                                                       \
+  size_t max_depth; /* Length of the longest keyword */                \
+  MatchStream_##ACM_SYMBOL *stream; /* Pending matches, carried over the texts of a stream */ \
+  int streamed;  /* Whether text may be followed by other texts of the stream */ \
+  size_t nb;     /* Number of reported matches */                      \
+};                                                                     \
+\
+/* Reports the leftmost pending matches which no match starting at or after earliest can precede. */\
+/* The pending matches start in a window of stream->size positions: they are scanned once, in the order of their starts. */\
+static void                                                            \
+match_records_resolve_##ACM_SYMBOL (struct _ac_records_##ACM_SYMBOL *records, size_t earliest) \
+{                                                                      \
+  MatchStream_##ACM_SYMBOL *stream = records->stream;                  \
+  while (stream->nb_pending)                                           \
+  {                                                                    \
+    while (!stream->pending[stream->first % stream->size].end)         \
+      stream->first++;                                                 \
+    if (stream->first >= earliest)                                     \
+      return;                                                          \
+    MatchRecord_##ACM_SYMBOL record = stream->pending[stream->first % stream->size]; \
+    stream->pending[stream->first % stream->size].end = 0;             \
+    stream->nb_pending--;                                              \
+    if (records->handler)                                              \
+      records->handler (record, records->context);                     \
+    records->nb++;                                                     \
+    stream->last_end = record.end;                                     \
+    /* The matches overlapping the reported one are discarded. */      \
+    for (; stream->nb_pending && stream->first < record.end; stream->first++) \
+      if (stream->pending[stream->first % stream->size].end)           \
+      {                                                                \
+        stream->pending[stream->first % stream->size].end = 0;         \
+        stream->nb_pending--;                                          \
+      }                                                                \
+  }                                                                    \
+}                                                                      \
+\
+/* Grows the slots of the pending matches and of the word symbols of a stream to size, for the longer keywords registered */\
+/* since its previous text, ending at position end: the pending matches start in a window shorter than both sizes, */\
+/* and are moved to the slots of their starts, as the word symbols of the last positions to the slots of their positions. */\
+static void                                                            \
+match_stream_grow_##ACM_SYMBOL (MatchStream_##ACM_SYMBOL *stream, size_t size, size_t end) \
+{                                                                      \
+  if (stream->pending)                                                 \
+  {                                                                    \
+    MatchRecord_##ACM_SYMBOL *pending = calloc (size, sizeof (*pending)); \
+    ACM_ASSERT (pending);                                              \
+    for (size_t i = 0; i < stream->size; i++)                          \
+      if (stream->pending[i].end)                                      \
+        pending[stream->pending[i].start % size] = stream->pending[i]; \
+    free (stream->pending);                                            \
+    stream->pending = pending;                                         \
+  }                                                                    \
+  if (stream->is_word_at)                                              \
+  {                                                                    \
+    unsigned char *is_word_at = calloc (size, sizeof (*is_word_at));   \
+    ACM_ASSERT (is_word_at);                                           \
+    for (size_t position = end > stream->size ? end - stream->size : 0; position < end; position++) \
+      is_word_at[position % size] = stream->is_word_at[position % stream->size]; \
+    free (stream->is_word_at);                                         \
+    stream->is_word_at = is_word_at;                                   \
+  }                                                                    \
+  stream->size = size;                                                 \
+}                                                                      \
+/* Reports a match (ACM_MATCH_ALL), or keeps it pending (leftmost modes). */\
+static void                                                            \
+match_records_add_##ACM_SYMBOL (struct _ac_records_##ACM_SYMBOL *records, MatchRecord_##ACM_SYMBOL record) \
+{                                                                      \
+  if (records->mode == ACM_MATCH_ALL)                                  \
+  {                                                                    \
+    if (records->handler)                                              \
+      records->handler (record, records->context);                     \
+    records->nb++;                                                     \
+    return;                                                            \
+  }                                                                    \
+  MatchStream_##ACM_SYMBOL *stream = records->stream;                  \
+  if (record.start < stream->last_end)                                 \
+    return;                                                            \
+  if (!stream->pending)                                                \
+    ACM_ASSERT (stream->pending = calloc (stream->size, sizeof (*stream->pending))); \
+  /* Only the preferred match is kept for a start. */                  \
+  MatchRecord_##ACM_SYMBOL *pending = &stream->pending[record.start % stream->size]; \
+  if (!pending->end)                                                   \
+  {                                                                    \
+    if (!stream->nb_pending || record.start < stream->first)           \
+      stream->first = record.start;                                    \
+    stream->nb_pending++;                                              \
+    *pending = record;                                                 \
+  }                                                                    \
+  else if (records->mode == ACM_MATCH_LEFTMOST_FIRST ? record.rank < pending->rank : record.end > pending->end) \
+    *pending = record;                                                 \
+}                                                                      \
+\
+static void                                                            \
+match_record_##ACM_SYMBOL (size_t rank, size_t length, void *value, void *context) \
+{                                                                      \
+  struct _ac_records_##ACM_SYMBOL *records = context;                  \
+  MatchRecord_##ACM_SYMBOL record = { records->end - length, records->end, rank, value }; \
+  /* Whole words only: the boundaries are checked once per match, on the symbols of the stream around it. */\
+  if (records->is_word)                                                \
+  {                                                                    \
+    MatchStream_##ACM_SYMBOL *stream = records->stream;                \
+    /* The symbols preceding text are known by the word symbols of the stream they were. */\
+    if (record.start < stream->begin ||                                \
+        (record.start > stream->begin &&                               \
+         (record.start > records->offset ? records->is_word (records->text[record.start - records->offset - 1]) : \
+                                           stream->is_word_at[(record.start - 1) % stream->size]))) \
+      return;                                                          \
+    if (record.end < records->offset + records->length)                \
+    {                                                                  \
+      if (records->is_word (records->text[record.end - records->offset])) \
+        return;                                                        \
+    }                                                                  \
+    /* The symbol following a match at the end of text is the first one of the next text. */\
+    else if (records->streamed)                                        \
+    {                                                                  \
+      if (stream->nb_deferred == stream->size_deferred)                \
+      {                                                                \
+        stream->size_deferred = stream->size_deferred ? 2 * stream->size_deferred : 16; \
+        ACM_ASSERT (stream->deferred = realloc (stream->deferred, sizeof (*stream->deferred) * stream->size_deferred)); \
+      }                                                                \
+      stream->deferred[stream->nb_deferred++] = record;                \
+      return;                                                          \
+    }                                                                  \
+  }                                                                    \
+  match_records_add_##ACM_SYMBOL (records, record);                    \
+}                                                                      \
+\
+static void                                                            \
+match_records_at_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t i, size_t nb, void *context) \
+{                                                                      \
+  (void) nb; /* The matches are enumerated by foreach_match. */        \
+  struct _ac_records_##ACM_SYMBOL *records = context;                  \
+  records->end = records->offset + i + 1;                              \
+  /* The matches ending here or later start at the earliest max_depth symbols before. */\
+  if (records->mode != ACM_MATCH_ALL)                                  \
+    match_records_resolve_##ACM_SYMBOL (records, records->end > records->max_depth ? records->end - records->max_depth : 0); \
+  state->vtable->foreach_match (state, match_record_##ACM_SYMBOL, records); \
+}                                                                      \
+\
+/* The length of a matching keyword is the depth of its state: the start of a match is known without retrieving its symbols. */\
+/* In the leftmost modes, the matches which do not overlap the reported ones are kept pending, in a window of the length */\
+/* of the longest keyword, until no later match can precede them: the text is parsed once, in a single pass. */\
+/* A null text ends the stream (see ACM_end_records). */               \
+static size_t                                                          \
+ACM_match_records_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, const ACM_SYMBOL * text, size_t length, \
+                                MATCH_RECORD_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context, size_t offset, int mode, \
+                                MatchStream_##ACM_SYMBOL * stream)     \
+{                                                                      \
+  MatchStream_##ACM_SYMBOL whole = { 0 };                              \
+  if (!text)                                                           \
+  {                                                                    \
+    if (!stream)                                                       \
+      return 0;                                                        \
+    struct _ac_records_##ACM_SYMBOL records =                          \
+      { .handler = handler, .context = context, .mode = stream->mode & ~ACM_MATCH_WORDS, .stream = stream }; \
+    /* The end of the stream is a word boundary. */                    \
+    for (size_t i = 0; i < stream->nb_deferred; i++)                   \
+      match_records_add_##ACM_SYMBOL (&records, stream->deferred[i]);  \
+    match_records_resolve_##ACM_SYMBOL (&records, SIZE_MAX);           \
+    free (stream->pending);                                            \
+    free (stream->is_word_at);                                         \
+    free (stream->deferred);                                           \
+    *stream = whole;                                                   \
+    return records.nb;                                                 \
+  }                                                                    \
+  if (!stream)                                                         \
+    stream = &whole;                                                   \
+  if (!stream->started)                                                \
+  {                                                                    \
+    stream->started = 1;                                               \
+    stream->mode = mode;                                               \
+    stream->begin = stream->last_end = offset;                         \
+  }                                                                    \
+  /* Keywords may have been registered since the previous text of the stream. */\
+  if ((*pstate)->machine->max_depth + 1 > stream->size)               \
+    match_stream_grow_##ACM_SYMBOL (stream, (*pstate)->machine->max_depth + 1, offset); \
+  struct _ac_records_##ACM_SYMBOL records =                            \
+  {                                                                    \
+    .handler = handler, .context = context, .offset = offset, .mode = mode & ~ACM_MATCH_WORDS, \
+    .is_word = (mode & ACM_MATCH_WORDS) ? (*pstate)->machine->is_word : 0, .text = text, .length = length, \
+    .max_depth = (*pstate)->machine->max_depth, .stream = stream, .streamed = stream != &whole, \
+  };                                                                   \
+  if (records.mode == ACM_MATCH_ALL && !records.is_word)               \
+    return (*pstate)->vtable->match_buffer (pstate, text, length, handler ? match_records_at_##ACM_SYMBOL : 0, &records); \
+  /* The matches ending at the end of the previous text are whole words if text does not start with a word symbol. */\
+  if (stream->nb_deferred && length)                                   \
+  {                                                                    \
+    if (!records.is_word (text[0]))                                    \
+      for (size_t i = 0; i < stream->nb_deferred; i++)                 \
+        match_records_add_##ACM_SYMBOL (&records, stream->deferred[i]); \
+    stream->nb_deferred = 0;                                           \
+  }                                                                    \
+  (*pstate)->vtable->match_buffer (pstate, text, length, match_records_at_##ACM_SYMBOL, &records); \
+  /* The word symbols of the last max_depth + 1 symbols of the stream are kept for the matches ending in the next texts. */\
+  if (records.is_word && records.streamed)                             \
+  {                                                                    \
+    if (!stream->is_word_at)                                           \
+      ACM_ASSERT (stream->is_word_at = calloc (stream->size, sizeof (*stream->is_word_at))); \
+    for (size_t i = length > stream->size ? length - stream->size : 0; i < length; i++) \
+      stream->is_word_at[(offset + i) % stream->size] = records.is_word (text[i]) ? 1 : 0; \
+  }                                                                    \
+  if (records.mode == ACM_MATCH_ALL)                                   \
+    return records.nb;                                                 \
+  if (stream == &whole)                                                \
+  {                                                                    \
+    match_records_resolve_##ACM_SYMBOL (&records, SIZE_MAX);           \
+    free (whole.pending);                                              \
+  }                                                                    \
+  else                                                                 \
+    /* The matches ending in the next texts, or deferred, start at the earliest max_depth symbols before their beginning. */\
+    match_records_resolve_##ACM_SYMBOL (&records, offset + length > records.max_depth ? offset + length - records.max_depth : 0); \
+  return records.nb;                                                   \
+}                                                                      \
 \
 static const struct _acs_vtable_##ACM_SYMBOL ACS_VTABLE_##ACM_SYMBOL = \
 {                                                                      \
   ACM_match_##ACM_SYMBOL,                                              \
+  ACM_match_buffer_##ACM_SYMBOL,                                       \
   ACM_get_match_##ACM_SYMBOL,                                          \
+  ACM_foreach_match_##ACM_SYMBOL,                                      \
+  ACM_match_records_##ACM_SYMBOL,                                      \
+  ACM_get_match_view_##ACM_SYMBOL,                                     \
 };                                                                     \
 \
-ACState_##ACM_SYMBOL *                                                 \
-state_create_##ACM_SYMBOL (void)                                       \
+static const struct _acs_vtable_##ACM_SYMBOL ACS_FROZEN_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_match_frozen_##ACM_SYMBOL,                                       \
+  ACM_match_buffer_frozen_##ACM_SYMBOL,                                \
+  ACM_get_match_##ACM_SYMBOL,                                          \
+  ACM_foreach_match_##ACM_SYMBOL,                                      \
+  ACM_match_records_##ACM_SYMBOL,                                      \
+  ACM_get_match_view_##ACM_SYMBOL,                                     \
+};                                                                     \
+\
+/* Returns g(state, letter) in the flat representation of a frozen machine, or 0 if g(state, letter) = fail. */\
+/* (State 0 is the target of no transition.) */                       \
+static uint32_t                                                        \
+flat_next_##ACM_SYMBOL (const struct _ac_flat_##ACM_SYMBOL * flat, uint32_t state, ACM_SYMBOL letter, \
+                        EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt) \
+{                                                                      \
+  const struct _ac_hot_state_##ACM_SYMBOL *hot = flat->hot + state;    \
+  const ACM_SYMBOL *begin = flat->edge_letter + hot->first_edge;       \
+  const ACM_SYMBOL *end = begin + hot->nb_goto;                        \
+  if (flat->hash && hot->nb_goto >= ACM_HASH_MIN_FANOUT)   /* Hash table */ \
+  {                                                                    \
+    const uint32_t *table = flat->hash_table + flat->hash_offset[state]; \
+    size_t mask = __hash_mask__ (hot->nb_goto);                        \
+    for (size_t h = symbol_hash_##ACM_SYMBOL (flat->hash, letter) & mask; table[h]; h = (h + 1) & mask) \
+      if (__EQ_IS_BYTEWISE_##ACM_SYMBOL (eq) ? EQ_BYTEWISE (begin[table[h] - 1], letter) : eq (begin[table[h] - 1], letter)) \
+        return flat->edge_target[hot->first_edge + table[h] - 1];      \
+    return 0;                                                          \
+  }                                                                    \
+  if (lt)   /* Binary search */                                        \
+  {                                                                    \
+    while (begin < end)                                                \
+    {                                                                  \
+      const ACM_SYMBOL *middle = begin + (end - begin) / 2;            \
+      if (lt (*middle, letter))                                        \
+        begin = middle + 1;                                            \
+      else                                                             \
+        end = middle;                                                  \
+    }                                                                  \
+    if (begin < flat->edge_letter + hot->first_edge + hot->nb_goto &&  \
+        (__EQ_IS_BYTEWISE_##ACM_SYMBOL (eq) ? EQ_BYTEWISE (*begin, letter) : eq (*begin, letter))) \
+      return flat->edge_target[begin - flat->edge_letter];             \
+  }                                                                    \
+  else if (__EQ_IS_BYTEWISE_##ACM_SYMBOL (eq))                         \
+  {                                                                    \
+    for (const ACM_SYMBOL *p = begin; p < end; p++)                    \
+      if (EQ_BYTEWISE (*p, letter))                                    \
+        return flat->edge_target[p - flat->edge_letter];               \
+  }                                                                    \
+  else                                                                 \
+    for (const ACM_SYMBOL *p = begin; p < end; p++)                    \
+      if (eq (*p, letter))                                             \
+        return flat->edge_target[p - flat->edge_letter];               \
+  return 0;                                                            \
+}                                                                      \
+/* Aho-Corasick Algorithm 1 applied to the flat representation of a frozen machine (see state_goto). */\
+static uint32_t                                                        \
+flat_goto_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, uint32_t state, ACM_SYMBOL letter, \
+                        EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt) \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  while (1)                                                            \
+  {                                                                    \
+    if (!state)   /* [state 0] */                                      \
+    {                                                                  \
+      if (flat->root)                                                  \
+        return flat->root[*(const unsigned char *) &letter];           \
+    }                                                                  \
+    /* [if g(state, a[i]) != fail then return g(state, a[i])] */       \
+    uint32_t next = flat_next_##ACM_SYMBOL (flat, state, letter, eq, lt); \
+    if (next)                                                          \
+      return next;                                                     \
+    /* [if g(state, a[i]) = fail and state = 0 then return state 0] */ \
+    if (!state)                                                        \
+      return 0;                                                        \
+    /* [if g(state, a[i]) = fail and state != 0 then state <- f(state) */\
+    state = flat->hot[state].fail;                                     \
+  }                                                                    \
+}                                                                      \
+/* The state with a given number in the flat representation. */       \
+/* The states of a mapped machine are initialized on first use, possibly by several threads at once with the same values. */\
+static const ACState_##ACM_SYMBOL *                                    \
+flat_state_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, uint32_t state) \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  if (!flat->handle)                                                   \
+    return flat->state[state];                                         \
+  ACState_##ACM_SYMBOL *s = flat->handle + state;                      \
+  if (!__atomic_load_n (&s->vtable, __ATOMIC_ACQUIRE))                 \
+  {                                                                    \
+    __atomic_store_n (&s->machine, (ACMachine_##ACM_SYMBOL *) machine, __ATOMIC_RELAXED); \
+    __atomic_store_n (&s->index, state, __ATOMIC_RELAXED);             \
+    __atomic_store_n (&s->vtable, flat->handle->vtable, __ATOMIC_RELEASE); \
+  }                                                                    \
+  return s;                                                            \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_match_flat_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate, ACM_SYMBOL letter) \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine = (*pstate)->machine;          \
+  uint32_t state = flat_goto_##ACM_SYMBOL (machine, (*pstate)->index, NORMALIZE (machine->normalize, letter), \
+                                           machine->eq, machine->lt);  \
+  *pstate = flat_state_##ACM_SYMBOL (machine, state);                  \
+  return machine->flat->hot[state].nb_sequence;                        \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_match_buffer_flat_##ACM_SYMBOL (const ACState_##ACM_SYMBOL ** pstate,      \
+                                    const ACM_SYMBOL * text, size_t length,    \
+                                    MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context) \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine = (*pstate)->machine;          \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  EQ_##ACM_SYMBOL##_TYPE eq = machine->eq;                             \
+  LT_##ACM_SYMBOL##_TYPE lt = machine->lt;                             \
+  NORM_##ACM_SYMBOL##_TYPE normalize = machine->normalize;             \
+  uint32_t state = (*pstate)->index;                                   \
+  size_t nb = 0;                                                       \
+  for (size_t i = 0; i < length; i++)                                  \
+  {                                                                    \
+    /* The symbols which do not leave state 0 are skipped at once (see machine_root_bytes). */\
+    if (!state && machine->nb_root_bytes &&                            \
+        (i = __root_skip__ ((const unsigned char *) text, i, length, machine->root_byte, machine->nb_root_bytes)) == length) \
+      break;                                                           \
+    state = flat_goto_##ACM_SYMBOL (machine, state, NORMALIZE (normalize, text[i]), eq, lt); \
+    /* Aho-Corasick Algorithm 1: if output (state) != empty */         \
+    size_t nb_sequence = flat->hot[state].nb_sequence;                 \
+    if (nb_sequence)                                                   \
+    {                                                                  \
+      nb += nb_sequence;                                               \
+      /* The state of the tree is only looked for when a keyword matches. */\
+      if (handler)                                                     \
+        handler (flat_state_##ACM_SYMBOL (machine, state), i, nb_sequence, context); \
+    }                                                                  \
+  }                                                                    \
+  *pstate = flat_state_##ACM_SYMBOL (machine, state);                  \
+  return nb;                                                           \
+}                                                                      \
+/* ACM_get_match on the states of a mapped machine or of a snapshot: keywords are read backward in the image. */\
+static size_t                                                          \
+ACM_get_match_mapped_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index, \
+                                   MatchHolder_##ACM_SYMBOL * match, void **value) \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = state->machine->flat;     \
+  uint32_t s = state->index;                                           \
+  ACM_ASSERT (index < flat->hot[s].nb_sequence);                       \
+  if (!flat->cold[s].is_matching)                                      \
+    s = flat->cold[s].output;                                          \
+  for (size_t i = 0; i < index; i++)                                   \
+    s = flat->cold[s].output;                                          \
+  if (match)                                                           \
+  {                                                                    \
+    match->length = flat->cold[s].depth;                               \
+    ACM_ASSERT (match->letter = realloc (match->letter, sizeof (*match->letter) * match->length));         \
+    /* The transition to state number n is stored at position n - 1. */\
+    size_t i = match->length;                                          \
+    for (uint32_t r = s; r; r = flat->cold[r].previous)                \
+      match->letter[--i] = flat->edge_letter[r - 1];                   \
+    match->rank = flat->cold[s].rank;                                  \
+  }                                                                    \
+  if (value)                                                           \
+    *value = flat->value ? flat->value[s] : 0;                         \
+  return flat->cold[s].rank;                                           \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_get_match_view_mapped_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t index, \
+                                        MatchView_##ACM_SYMBOL * view, void **value) \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine = state->machine;              \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  uint32_t s = state->index;                                           \
+  ACM_ASSERT (index < flat->hot[s].nb_sequence);                       \
+  if (!flat->cold[s].is_matching)                                      \
+    s = flat->cold[s].output;                                          \
+  for (size_t i = 0; i < index; i++)                                   \
+    s = flat->cold[s].output;                                          \
+  view->letter = machine->pool ? machine->pool + machine->pool_offset[flat->cold[s].rank] : 0; \
+  view->length = flat->cold[s].depth;                                  \
+  view->rank = flat->cold[s].rank;                                     \
+  if (value)                                                           \
+    *value = flat->value ? flat->value[s] : 0;                         \
+  return flat->cold[s].rank;                                           \
+}                                                                      \
+\
+static size_t                                                          \
+ACM_foreach_match_mapped_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, \
+                                       void (*operator) (size_t, size_t, void *, void *), \
+                                       void *context)                  \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = state->machine->flat;     \
+  size_t nb = 0;                                                       \
+  uint32_t s = state->index;                                           \
+  for (s = flat->cold[s].is_matching ? s : flat->cold[s].output; s; s = flat->cold[s].output) \
+  {                                                                    \
+    if (operator)                                                      \
+      operator (flat->cold[s].rank, flat->cold[s].depth, flat->value ? flat->value[s] : 0, context); \
+    nb++;                                                              \
+  }                                                                    \
+  return nb;                                                           \
+}                                                                      \
+\
+static const struct _acs_vtable_##ACM_SYMBOL ACS_FLAT_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_match_flat_##ACM_SYMBOL,                                         \
+  ACM_match_buffer_flat_##ACM_SYMBOL,                                  \
+  ACM_get_match_##ACM_SYMBOL,                                          \
+  ACM_foreach_match_##ACM_SYMBOL,                                      \
+  ACM_match_records_##ACM_SYMBOL,                                      \
+  ACM_get_match_view_##ACM_SYMBOL,                                     \
+};                                                                     \
+\
+static const struct _acs_vtable_##ACM_SYMBOL ACS_MAPPED_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_match_flat_##ACM_SYMBOL,                                         \
+  ACM_match_buffer_flat_##ACM_SYMBOL,                                  \
+  ACM_get_match_mapped_##ACM_SYMBOL,                                   \
+  ACM_foreach_match_mapped_##ACM_SYMBOL,                               \
+  ACM_match_records_##ACM_SYMBOL,                                      \
+  ACM_get_match_view_mapped_##ACM_SYMBOL,                              \
+};                                                                     \
+\
+static const struct _acs_vtable_##ACM_SYMBOL ACS_COMPILED_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_match_compiled_##ACM_SYMBOL,                                     \
+  ACM_match_buffer_compiled_##ACM_SYMBOL,                              \
+  ACM_get_match_##ACM_SYMBOL,                                          \
+  ACM_foreach_match_##ACM_SYMBOL,                                      \
+  ACM_match_records_##ACM_SYMBOL,                                      \
+  ACM_get_match_view_##ACM_SYMBOL,                                     \
+};                                                                     \
+\
+static void                                                            \
+state_vtable_set_##ACM_SYMBOL (ACState_##ACM_SYMBOL * r,               \
+                               const struct _acs_vtable_##ACM_SYMBOL * vtable) \
+{                                                                      \
+  r->vtable = vtable;                                                  \
+  struct _ac_next_##ACM_SYMBOL *p = r->goto_array;                     \
+  struct _ac_next_##ACM_SYMBOL *end = p + r->nb_goto;                  \
+  for (; p < end; p++)                                                 \
+    state_vtable_set_##ACM_SYMBOL (p->state, vtable);                  \
+}                                                                      \
+/* Discards the transition table [delta] before the goto function is modified. */\
+static void                                                            \
+machine_decompile_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)      \
+{                                                                      \
+  if (!machine->transitions)                                           \
+    return;                                                            \
+  state_vtable_set_##ACM_SYMBOL (machine->state_0, &(ACS_VTABLE_##ACM_SYMBOL)); \
+  free (machine->transitions);                                         \
+  machine->transitions = 0;                                            \
+  free (machine->alphabet);                                            \
+  machine->alphabet = 0;                                               \
+  free (machine->alphabet_hash);                                       \
+  machine->alphabet_hash = 0;                                          \
+  machine->alphabet_hash_mask = machine->nb_classes = 0;               \
+}                                                                      \
+\
+static void                                                            \
+state_init_##ACM_SYMBOL (ACState_##ACM_SYMBOL * s)                     \
 {                                                                      \
-  ACState_##ACM_SYMBOL *s = malloc (sizeof (*s)); /* [state s] */      \
-  ACM_ASSERT (s);                                                      \
   /* [g(s, a) is undefined (= fail) for all input symbol a] */         \
   s->goto_array = 0;                                                   \
   s->nb_goto = 0;                                                      \
+  s->goto_hash = 0;                                                    \
   s->previous.state = 0;                                               \
   s->previous.i_letter = 0;                                            \
   /* Aho-Corasick Algorithm 2: "We assume output(s) is empty when state s is first created." */ \
   s->nb_sequence = 0;           /* number of outputs in [output(s)] */ \
   s->is_matching = 0; /* if 1, indicates that the state is the last node of a registered keyword */   \
   s->fail_state = 0;                                                   \
+  s->fail_tree.first_child = s->fail_tree.next_sibling = s->fail_tree.previous_sibling = 0; \
+  s->output_state = 0;                                                 \
+  s->transition = 0;                                                   \
   s->rank = 0;                                                         \
+  s->depth = 0;                                                        \
+  s->index = 0;                                                        \
   s->value = 0;                                                        \
   s->value_dtor = 0;                                                   \
   s->machine = 0;                                                      \
   s->vtable = &(ACS_VTABLE_##ACM_SYMBOL);                              \
+}                                                                      \
+\
+ACState_##ACM_SYMBOL *                                                 \
+state_create_##ACM_SYMBOL (void)                                       \
+{                                                                      \
+  ACState_##ACM_SYMBOL *s = malloc (sizeof (*s)); /* [state s] */      \
+  ACM_ASSERT (s);                                                      \
+  state_init_##ACM_SYMBOL (s);                                         \
+  return s;                                                            \
+}                                                                      \
+/* States other than state 0 are allocated in the arena of the machine (size class 0). */\
+static ACState_##ACM_SYMBOL *                                          \
+machine_state_create_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)   \
+{                                                                      \
+  ACState_##ACM_SYMBOL *s = __arena_alloc__ (&machine->arena, sizeof (*s), 0); /* [state s] */\
+  state_init_##ACM_SYMBOL (s);                                         \
+  s->machine = machine;                                                \
   return s;                                                            \
 }                                                                      \
+/* Destroys a value, or defers it until the published snapshots which can still read it are released. */\
+static void                                                            \
+machine_value_release_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, void *value, void (*dtor) (void *)) \
+{                                                                      \
+  if (!machine->snapshot)                                              \
+  {                                                                    \
+    dtor (value);                                                      \
+    return;                                                            \
+  }                                                                    \
+  struct _ac_retired_value *r = malloc (sizeof (*r));                  \
+  ACM_ASSERT (r);                                                      \
+  r->value = value;                                                    \
+  r->dtor = dtor;                                                      \
+  r->next = machine->retired_values;                                   \
+  machine->retired_values = r;                                         \
+}                                                                      \
+/* Appends the keyword of a matching state to the pool of keywords, at the position of its rank. */\
+static void                                                            \
+machine_pool_append_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, const ACState_##ACM_SYMBOL * state) \
+{                                                                      \
+  if (machine->pool_length + state->depth > machine->pool_size)        \
+  {                                                                    \
+    size_t size = 2 * machine->pool_size > machine->pool_length + state->depth ? \
+                  2 * machine->pool_size : machine->pool_length + state->depth; \
+    ACM_ASSERT (machine->pool = realloc (machine->pool, sizeof (*machine->pool) * size)); \
+    machine->pool_size = size;                                         \
+  }                                                                    \
+  if (state->rank >= machine->pool_nb_offsets)                         \
+  {                                                                    \
+    size_t nb = 2 * machine->pool_nb_offsets > state->rank ? 2 * machine->pool_nb_offsets : state->rank + 1; \
+    ACM_ASSERT (machine->pool_offset = realloc (machine->pool_offset, sizeof (*machine->pool_offset) * nb)); \
+    memset (machine->pool_offset + machine->pool_nb_offsets, 0, sizeof (*machine->pool_offset) * (nb - machine->pool_nb_offsets)); \
+    machine->pool_nb_offsets = nb;                                     \
+  }                                                                    \
+  machine->pool_offset[state->rank] = machine->pool_length;            \
+  /* The keyword is read backward from the matching state to the state 0, as by ACM_get_match. */\
+  machine->pool_length += state->depth;                                \
+  size_t i = machine->pool_length;                                     \
+  for (const ACState_##ACM_SYMBOL * s = state; s->previous.state; s = s->previous.state) \
+    machine->pool[--i] = machine->copy (s->previous.state->goto_array[s->previous.i_letter].letter); \
+}                                                                      \
+\
+static void                                                            \
+state_pool_fill_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, const ACState_##ACM_SYMBOL * state) \
+{                                                                      \
+  if (state->is_matching)                                              \
+    machine_pool_append_##ACM_SYMBOL (machine, state);                 \
+  for (size_t i = 0; i < state->nb_goto; i++)                          \
+    state_pool_fill_##ACM_SYMBOL (machine, state->goto_array[i].state); \
+}                                                                      \
+\
+static int                                                             \
+ACM_pool_keywords_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)      \
+{                                                                      \
+  if (machine->pool)                                                   \
+    return 1;                                                          \
+  /* The pool is allocated even if there is no keyword yet: it tells that the keywords registered later are pooled. */\
+  machine->pool_size = 1;                                              \
+  machine->pool_nb_offsets = machine->rank ? machine->rank : 1;        \
+  ACM_ASSERT (machine->pool = malloc (sizeof (*machine->pool) * machine->pool_size)); \
+  ACM_ASSERT (machine->pool_offset = calloc (machine->pool_nb_offsets, sizeof (*machine->pool_offset))); \
+  state_pool_fill_##ACM_SYMBOL (machine, machine->state_0);            \
+  return 1;                                                            \
+}                                                                      \
+\
 /* Aho-Corasick Algorithm 2: construction of the goto function - procedure enter(a[1] a[2] ... a[n]). */\
 static int                                                             \
 machine_goto_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine,    \
                                   Keyword_##ACM_SYMBOL sequence /* a[1] a[2] ... a[n] */, \
                                   void *value, void (*dtor) (void *))  \
 {                                                                      \
-  if (!sequence.length)                                                \
+  if (!sequence.length || machine->frozen)                             \
   {                                                                    \
     if (dtor)                                                          \
       dtor (value);                                                    \
     return 0;                                                          \
   }                                                                    \
+  machine_decompile_##ACM_SYMBOL (machine);                            \
   ACState_##ACM_SYMBOL *state_0 = machine->state_0; /* [state 0] */    \
   /* Iterators */                                                      \
   /* Aho-Corasick Algorithm 2: state <- 0 */                           \
@@ -432,18 +1983,10 @@ machine_goto_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine,    \
   /* Iterations on i and s until a final state */                      \
   for (; j < sequence.length /* [j <= m] */ ;)                         \
   {                                                                    \
-    ACState_##ACM_SYMBOL *next = 0;                                    \
     /* Aho-Corasick Algorithm 2: "g(s, l) = fail if l is undefined or if g(s, l) has not been defined." */\
-    /* Loop on all symbols a for which g(state, a) is defined. */      \
-    struct _ac_next_##ACM_SYMBOL *p = state->goto_array;               \
-    struct _ac_next_##ACM_SYMBOL *end = p + state->nb_goto;            \
-    for (; p < end; p++)                                               \
-      if (machine->eq (p->letter, sequence.letter[j]))                 \
-      {                                                                \
-        /* [if g(state, a[j]) is defined] */                           \
-        next = p->state;                                               \
-        break;                                                         \
-      }                                                                \
+    /* Look for a symbol a for which g(state, a) is defined. */        \
+    ACState_##ACM_SYMBOL *next =                                       \
+      state_next_##ACM_SYMBOL (state, NORMALIZE (machine->normalize, sequence.letter[j]), machine->eq, machine->lt); \
     /* [if g(state, a[j]) is defined (!= fail)] */                     \
     if (next)                                                          \
     {                                                                  \
@@ -458,38 +2001,65 @@ machine_goto_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine,    \
   }                                                                    \
   /* Aho-Corasick Algorithm 2: for p <- j until m do */                \
   /* Appending states for the new sequence to the final state found */ \
+  ACState_##ACM_SYMBOL *first_newstate = 0;                            \
   for (size_t p = j; p < sequence.length /* [p <= m] */ ; p++)         \
   {                                                                    \
-    state->nb_goto++;                                                  \
-    ACM_ASSERT (state->goto_array = realloc (state->goto_array,        \
-                sizeof (*state->goto_array) * state->nb_goto));        \
+    ACM_SYMBOL letter = NORMALIZE (machine->normalize, sequence.letter[p]); \
+    /* Index of the new symbol in goto_array: appended, or inserted in order if lt is defined. */\
+    size_t i_letter = machine->lt ?                                    \
+      (size_t) (state_lower_bound_##ACM_SYMBOL (state, letter, machine->lt) - state->goto_array) : \
+      state->nb_goto;                                                  \
+    state_goto_array_resize_##ACM_SYMBOL (machine, state, state->nb_goto + 1); \
+    memmove (state->goto_array + i_letter + 1, state->goto_array + i_letter, \
+             sizeof (*state->goto_array) * (state->nb_goto - 1 - i_letter));  \
+    for (size_t k = i_letter + 1; k < state->nb_goto; k++)             \
+      state->goto_array[k].state->previous.i_letter = k;               \
     /* Creation of a new state */                                      \
     /* Aho-Corasick Algorithm 2: newstate <- newstate + 1 */           \
-    ACState_##ACM_SYMBOL *newstate = state_create_##ACM_SYMBOL ();     \
-    newstate->machine = machine;                                       \
+    ACState_##ACM_SYMBOL *newstate = machine_state_create_##ACM_SYMBOL (machine); \
     newstate->id = ++machine->state_counter; /* state UID */           \
     /* Aho-Corasick Algorithm 2: g(state, a[p]) <- newstate */         \
-    state->goto_array[state->nb_goto - 1].state = newstate;            \
-    state->goto_array[state->nb_goto - 1].letter = machine->copy (sequence.letter[p]);  \
+    state->goto_array[i_letter].state = newstate;                      \
+    state->goto_array[i_letter].letter = machine->copy (letter);       \
+    state_goto_hash_update_##ACM_SYMBOL (machine, state, i_letter, 1); \
     /* Backward link: previous(newstate, a[p]) <- state */             \
     newstate->previous.state = state;                                  \
-    /* state->goto_array[state->nb_goto - 1].state->previous.i_letter = state->nb_goto - 1; */\
-    newstate->previous.i_letter = state->nb_goto - 1;                  \
+    newstate->previous.i_letter = i_letter;                            \
+    newstate->depth = state->depth + 1;                                \
+    if (!first_newstate)                                               \
+      first_newstate = newstate;                                       \
     /* Aho-Corasick Algorithm 2: state <- newstate */                  \
     state = newstate;                                                  \
     machine->size++;                                                   \
   }                                                                    \
+  if (state->depth > machine->max_depth)                               \
+    machine->max_depth = state->depth;                                 \
+  /* If the failure function is up to date, it is updated for the new states only, in order of depth */\
+  /* (otherwise, it will be constructed by the next call to ACM_match). */\
+  int incremental = !machine->reconstruct;                             \
+  if (incremental && first_newstate)                                   \
+  {                                                                    \
+    if (first_newstate->previous.state == state_0)                     \
+      machine_root_index_##ACM_SYMBOL (machine);                       \
+    for (ACState_##ACM_SYMBOL * s = first_newstate; s; s = s->nb_goto ? s->goto_array[0].state : 0) \
+      state_fail_state_insert_##ACM_SYMBOL (machine, s);               \
+  }                                                                    \
   if (!state->is_matching)                                             \
   {                                                                    \
     /* Aho-Corasick Algorithm 2: output (state) <- { a[1] a[2] ... a[n] } */\
     /* Aho-Corasick Algorithm 2: "We assume output(s) is empty when state s is first created." */\
     /* Adding the sequence to the last found state (created or not) */ \
     state->is_matching = 1;                                            \
-    state->nb_sequence = 1;                                            \
     state->rank = machine->rank++; /* rank is a 0-based index */       \
     machine->nb_sequence++;                                            \
-    if (!machine->reconstruct)                                         \
-      machine->reconstruct = 2; /* f(s) must be recomputed */          \
+    if (machine->pool)                                                 \
+      machine_pool_append_##ACM_SYMBOL (machine, state);               \
+    /* The new output is added to the states whose chain of failure states goes through state. */\
+    if (incremental)                                                   \
+    {                                                                  \
+      state->nb_sequence++;                                            \
+      state_output_update_##ACM_SYMBOL (state, state, 1);              \
+    }                                                                  \
   }                                                                    \
   /* If the keyword was already previously registered (state->is_matching != 0) */\
   else if (ACM_KEEP_VALUE)                                             \
@@ -502,9 +2072,13 @@ machine_goto_update_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine,    \
   }                                                                    \
   /* if (!state->is_matching || !ACM_KEEP_VALUE) */                    \
   if (state->value_dtor)                                               \
-    state->value_dtor (state->value);                                  \
+  {                                                                    \
+    machine_value_release_##ACM_SYMBOL (machine, state->value, state->value_dtor); \
+    machine->nb_value_dtor--;                                          \
+  }                                                                    \
   state->value = value;                                                \
-  state->value_dtor = dtor;                                            \
+  if ((state->value_dtor = dtor))                                      \
+    machine->nb_value_dtor++;                                          \
   return 1;                                                            \
 }                                                                      \
 \
@@ -513,17 +2087,19 @@ machine_init_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL *machine,            \
                              ACState_##ACM_SYMBOL * state_0,           \
                              EQ_##ACM_SYMBOL##_TYPE eq,                \
                              COPY_##ACM_SYMBOL##_TYPE copier,          \
-                             DESTROY_##ACM_SYMBOL##_TYPE dtor);        \
+                             DESTROY_##ACM_SYMBOL##_TYPE dtor,         \
+                             LT_##ACM_SYMBOL##_TYPE lt);               \
 \
 __attribute__ ((unused)) ACMachine_##ACM_SYMBOL *ACM_create_##ACM_SYMBOL (EQ_##ACM_SYMBOL##_TYPE eq, \
                                                  COPY_##ACM_SYMBOL##_TYPE copier,  \
-                                                 DESTROY_##ACM_SYMBOL##_TYPE dtor) \
+                                                 DESTROY_##ACM_SYMBOL##_TYPE dtor, \
+                                                 LT_##ACM_SYMBOL##_TYPE lt) \
 {                                                                      \
   ACMachine_##ACM_SYMBOL *machine = malloc (sizeof (*machine));        \
   ACM_ASSERT (machine);                                                \
   /* Aho-Corasick Algorithm 2: newstate <- 0 */                        \
   /* Create state 0. */                                                \
-  machine_init_##ACM_SYMBOL (machine, state_create_##ACM_SYMBOL (), eq, copier, dtor); \
+  machine_init_##ACM_SYMBOL (machine, state_create_##ACM_SYMBOL (), eq, copier, dtor, lt); \
   return machine;                                                      \
 }                                                                      \
 \
@@ -548,6 +2124,28 @@ ACM_register_keyword_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, Keyword_##A
   /*       Thus, the implementation slightly differs from the one proposed by Aho-Corasick. */\
 }                                                                      \
 \
+/* Aho-Corasick Algorithm 2 applied to a set of keywords, followed by Algorithm 3 once for all. */\
+static size_t                                                          \
+ACM_register_keywords_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, const Keyword_##ACM_SYMBOL * keywords, \
+                                    size_t nb_keywords, void **values, void (*dtor) (void *)) \
+{                                                                      \
+  /* At most one state is created per symbol: the arena is prepared for them, to be allocated in a few large chunks. */\
+  size_t nb_symbols = 0;                                               \
+  for (size_t i = 0; i < nb_keywords && !machine->frozen; i++)         \
+    nb_symbols += keywords[i].length;                                  \
+  __arena_reserve__ (&machine->arena,                                  \
+                     nb_symbols * (sizeof (ACState_##ACM_SYMBOL) + 2 * sizeof (struct _ac_next_##ACM_SYMBOL))); \
+  /* For a set of keywords as large as the machine, a single construction of the failure function */\
+  /* is cheaper than incremental updates after each keyword. */       \
+  if (!machine->reconstruct && nb_symbols >= machine->size)            \
+    machine->reconstruct = 2; /* f(s) must be recomputed */            \
+  size_t nb = 0;                                                       \
+  for (size_t i = 0; i < nb_keywords; i++)                             \
+    nb += (size_t) machine_goto_update_##ACM_SYMBOL (machine, keywords[i], values ? values[i] : 0, values ? dtor : 0); \
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
+  return nb;                                                           \
+}                                                                      \
+\
 static size_t                                                          \
 ACM_nb_keywords_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine)  \
 {                                                                      \
@@ -562,15 +2160,8 @@ get_last_state_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, Keyword_##A
   ACState_##ACM_SYMBOL *state = machine->state_0; /* [state 0] */      \
   for (size_t j = 0; j < sequence.length; j++)                         \
   {                                                                    \
-    ACState_##ACM_SYMBOL *next = 0;                                    \
-    struct _ac_next_##ACM_SYMBOL *p = state->goto_array;               \
-    struct _ac_next_##ACM_SYMBOL *end = p + state->nb_goto;            \
-    for (; p < end; p++)                                               \
-      if (machine->eq (p->letter, sequence.letter[j]))                 \
-      {                                                                \
-        next = p->state;                                               \
-        break;                                                         \
-      }                                                                \
+    ACState_##ACM_SYMBOL *next =                                       \
+      state_next_##ACM_SYMBOL (state, NORMALIZE (machine->normalize, sequence.letter[j]), machine->eq, machine->lt); \
     if (next)                                                          \
       state = next;                                                    \
     else                                                               \
@@ -593,46 +2184,69 @@ ACM_is_registered_keyword_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine,
 static int                     \
 ACM_unregister_keyword_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, Keyword_##ACM_SYMBOL y)  \
 {                                                                      \
+  if (machine->frozen)                                                 \
+    return 0;                                                          \
   ACState_##ACM_SYMBOL *last = get_last_state_##ACM_SYMBOL (machine, y); \
   if (!last)    /* The keyword y is not a registered keyword */        \
     return 0;                                                          \
+  machine_decompile_##ACM_SYMBOL (machine);                            \
   ACState_##ACM_SYMBOL *state_0 = machine->state_0; /* [state 0] */    \
   /* machine->rank is not decreased, so as to ensure unicity. */       \
   machine->nb_sequence--;                                              \
-  if (last->nb_goto)  /* The keyword y is the prefix of another registered keyword */ \
+  /* If the failure function is up to date, it is updated for the affected states only */\
+  /* (otherwise, it will be constructed by the next call to ACM_match). */\
+  int incremental = !machine->reconstruct;                             \
+  /* The output of last is removed from the states whose chain of failure states goes through last. */\
+  if (incremental)                                                     \
   {                                                                    \
-    last->is_matching = 0; /* not matching  nymore */                  \
-    last->nb_sequence = 0;                                             \
-    last->rank = 0;                                                    \
-    return 1;                                                          \
+    last->nb_sequence--;                                               \
+    state_output_update_##ACM_SYMBOL (last, last, 0);                  \
   }                                                                    \
+  last->is_matching = 0; /* not matching  nymore */                    \
+  last->rank = 0;                                                      \
+  if (last->nb_goto)  /* The keyword y is the prefix of another registered keyword */ \
+    return 1;                                                          \
   /* From here, last->nb_goto == 0 */                                  \
   ACState_##ACM_SYMBOL *prev = 0;                                      \
   do  /* backward processing the keyword y */                          \
   {                                                                    \
     prev = last->previous.state;                                       \
-    /* Remove last from prev->goto_array */                            \
-    prev->nb_goto--;                                                   \
-    for (size_t k = last->previous.i_letter; k < prev->nb_goto; k++)   \
+    /* Remove last from prev->goto_array (keeping the order of the other symbols) */\
+    size_t nb_goto = prev->nb_goto - 1;                                \
+    machine->destroy (prev->goto_array[last->previous.i_letter].letter); \
+    for (size_t k = last->previous.i_letter; k < nb_goto; k++)         \
     {                                                                  \
-      machine->destroy (prev->goto_array[k].letter);                   \
       prev->goto_array[k] = prev->goto_array[k + 1];                   \
       prev->goto_array[k].state->previous.i_letter = k;                \
     }                                                                  \
-    prev->goto_array = realloc (prev->goto_array, sizeof (*prev->goto_array) * prev->nb_goto);  \
-    ACM_ASSERT (!prev->nb_goto || prev->goto_array);                   \
+    state_goto_array_resize_##ACM_SYMBOL (machine, prev, nb_goto);     \
+    state_goto_hash_update_##ACM_SYMBOL (machine, prev, last->previous.i_letter, 0); \
+    /* The states failing to last now fail to f(last), and last is removed from the tree of the inverse failure function. */\
+    if (incremental)                                                   \
+    {                                                                  \
+      for (ACState_##ACM_SYMBOL * t; (t = last->fail_tree.first_child);) \
+      {                                                                \
+        state_fail_tree_unlink_##ACM_SYMBOL (t);                       \
+        state_fail_tree_link_##ACM_SYMBOL (t, last->fail_state);       \
+      }                                                                \
+      state_fail_tree_unlink_##ACM_SYMBOL (last);                      \
+    }                                                                  \
     /* Release associated value; */                                    \
     if (last->value_dtor)                                              \
-      last->value_dtor (last->value);                                  \
-    /* Release last */                                                 \
-    free (last);                                                       \
+    {                                                                  \
+      machine_value_release_##ACM_SYMBOL (machine, last->value, last->value_dtor); \
+      machine->nb_value_dtor--;                                        \
+    }                                                                  \
+    /* Release last (back to the arena) */                             \
+    __arena_free__ (&machine->arena, last, 0);                         \
     machine->size--;                                                   \
     last = prev;                                                       \
   }                                                                    \
   while (prev && prev != state_0 && !prev->is_matching && !prev->nb_goto);  \
                                                                        \
-  if (!machine->reconstruct)                                           \
-    machine->reconstruct = 2;   /* f(s) must be recomputed */          \
+  /* The index of state 0 is out of date if a transition from state 0 was removed. */\
+  if (incremental && prev == state_0)                                  \
+    machine_root_index_##ACM_SYMBOL (machine);                         \
                                                                        \
   return 1;                                                            \
 }                                                                      \
@@ -674,31 +2288,97 @@ ACM_foreach_keyword_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, void (
 }                                                                      \
 \
 static void                                                            \
+machine_flat_release_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)   \
+{                                                                      \
+  if (!machine->flat)                                                  \
+    return;                                                            \
+  if (machine->flat->map)                                              \
+  {                                                                    \
+    if (machine->flat->mapped)                                         \
+      munmap (machine->flat->map, machine->flat->map_length);          \
+    else                                                               \
+      free (machine->flat->map);                                       \
+    free (machine->flat->handle);                                      \
+  }                                                                    \
+  else                                                                 \
+  {                                                                    \
+    free (machine->flat->hot);                                         \
+    free (machine->flat->edge_letter);                                 \
+    free (machine->flat->edge_target);                                 \
+    free (machine->flat->root);                                        \
+    free (machine->flat->hash_offset);                                 \
+    free (machine->flat->hash_table);                                  \
+    free (machine->flat->state);                                       \
+  }                                                                    \
+  free (machine->flat->value);                                         \
+  free (machine->flat);                                                \
+  machine->flat = 0;                                                   \
+}                                                                      \
+\
+/* Destroys the symbols and the associated values of the states (their memory is released with the arena). */\
+static void                                                            \
 state_release_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state,        \
                             DESTROY_##ACM_SYMBOL##_TYPE dtor)          \
 {                                                                      \
-  /* Release goto_array */                                             \
   struct _ac_next_##ACM_SYMBOL *p = state->goto_array;                 \
   struct _ac_next_##ACM_SYMBOL *end = p + state->nb_goto;              \
   for (; p < end; p++)                                                 \
   {                                                                    \
     state_release_##ACM_SYMBOL (p->state, dtor);                       \
-    if (dtor)                                                          \
-      dtor (p->letter);                                                \
+    dtor (p->letter);                                                  \
   }                                                                    \
-  free (state->goto_array);                                            \
   /* Release associated value */                                       \
   if (state->value_dtor)                                               \
     state->value_dtor (state->value);                                  \
-  /* Release state */                                                  \
-  free ((ACState_##ACM_SYMBOL *) state);                               \
 }                                                                      \
 \
+/* Releases a snapshot together with the values retired meanwhile (see ACM_publish). */\
+static void                                                            \
+machine_snapshot_free_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * snapshot) \
+{                                                                      \
+  for (struct _ac_retired_value * r; (r = snapshot->retired_values);)  \
+  {                                                                    \
+    snapshot->retired_values = r->next;                                \
+    r->dtor (r->value);                                                \
+    free (r);                                                          \
+  }                                                                    \
+  machine_flat_release_##ACM_SYMBOL (snapshot);                        \
+  pthread_mutex_destroy (&snapshot->lock);                             \
+  pthread_mutex_destroy (&snapshot->retired_lock);                     \
+  free (snapshot);                                                     \
+}                                                                      \
 static void                                                            \
 ACM_cleanup_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine)      \
 {                                                                      \
-  state_release_##ACM_SYMBOL (machine->state_0, machine->destroy);     \
+  /* The tree is traversed only if there is something to destroy, */  \
+  /* otherwise the release costs one call to free per chunk of the arena. */\
+  if (machine->nb_value_dtor || machine->destroy != __DTOR_##ACM_SYMBOL || \
+      DESTROY_##ACM_SYMBOL || (size_t) 0 != (size_t) (DESTROY_DEFAULT (ACM_SYMBOL))) \
+    state_release_##ACM_SYMBOL (machine->state_0, machine->destroy);   \
+  free (machine->state_0);                                             \
+  __arena_release__ (&((ACMachine_##ACM_SYMBOL *) machine)->arena);    \
+  free (machine->transitions);                                         \
+  free (machine->alphabet);                                            \
+  free (machine->alphabet_hash);                                       \
+  for (size_t i = 0; i < machine->pool_length; i++)                    \
+    machine->destroy (machine->pool[i]);                               \
+  free (machine->pool);                                                \
+  free (machine->pool_offset);                                         \
+  machine_root_index_clear_##ACM_SYMBOL ((ACMachine_##ACM_SYMBOL *) machine); \
+  machine_flat_release_##ACM_SYMBOL ((ACMachine_##ACM_SYMBOL *) machine); \
+  /* All the snapshots have been released by their readers. */         \
+  for (ACMachine_##ACM_SYMBOL * s; (s = machine->retired);)            \
+  {                                                                    \
+    ((ACMachine_##ACM_SYMBOL *) machine)->retired = s->retired;        \
+    machine_snapshot_free_##ACM_SYMBOL (s);                            \
+  }                                                                    \
+  if (machine->snapshot)                                               \
+  {                                                                    \
+    machine->snapshot->retired_values = machine->retired_values;       \
+    machine_snapshot_free_##ACM_SYMBOL (machine->snapshot);            \
+  }                                                                    \
   pthread_mutex_destroy (&((ACMachine_##ACM_SYMBOL *) machine)->lock); \
+  pthread_mutex_destroy (&((ACMachine_##ACM_SYMBOL *) machine)->retired_lock); \
 }                                                                      \
 \
 static void                                                            \
@@ -759,21 +2439,737 @@ ACM_print_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL *machine,               \
                         FILE* stream,                                  \
                         PRINT_##ACM_SYMBOL##_TYPE printer)             \
 {                                                                      \
-  if (machine->reconstruct)                                            \
-  {                                                                    \
-    pthread_mutex_lock (&machine->lock);                               \
-    if (machine->reconstruct)                                          \
-      state_fail_state_construct_##ACM_SYMBOL (machine);               \
-    pthread_mutex_unlock (&machine->lock);                             \
-  }                                                                    \
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
   fprintf (stream, "\n");                                              \
   state_print_##ACM_SYMBOL (machine->state_0, stream, 0, 0, printer);  \
   fprintf (stream, "\n");                                              \
 }                                                                      \
 \
+/* Adds a symbol of the keywords to the alphabet of a compiled machine, if not already in. */\
+static void                                                            \
+machine_alphabet_insert_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, ACM_SYMBOL letter) \
+{                                                                      \
+  if (machine_symbol_class_##ACM_SYMBOL (machine, letter))             \
+    return;                                                            \
+  /* The hash table is kept at most half full. */                      \
+  if (2 * (machine->nb_classes + 1) > machine->alphabet_hash_mask + 1) \
+  {                                                                    \
+    size_t size = machine->alphabet_hash ? 2 * (machine->alphabet_hash_mask + 1) : 16; \
+    free (machine->alphabet_hash);                                     \
+    ACM_ASSERT (machine->alphabet_hash = calloc (size, sizeof (*machine->alphabet_hash))); \
+    ACM_ASSERT (machine->alphabet = realloc (machine->alphabet, sizeof (*machine->alphabet) * size / 2)); \
+    machine->alphabet_hash_mask = size - 1;                            \
+    for (size_t c = 1; c < machine->nb_classes; c++)                   \
+    {                                                                  \
+      size_t h = symbol_hash_##ACM_SYMBOL (machine->hash, machine->alphabet[c]) & machine->alphabet_hash_mask; \
+      while (machine->alphabet_hash[h])                                \
+        h = (h + 1) & machine->alphabet_hash_mask;                     \
+      machine->alphabet_hash[h] = c;                                   \
+    }                                                                  \
+  }                                                                    \
+  size_t h = symbol_hash_##ACM_SYMBOL (machine->hash, letter) & machine->alphabet_hash_mask; \
+  while (machine->alphabet_hash[h])                                    \
+    h = (h + 1) & machine->alphabet_hash_mask;                         \
+  machine->alphabet[machine->nb_classes] = letter;                     \
+  machine->alphabet_hash[h] = machine->nb_classes++;                   \
+}                                                                      \
+\
+/* Aho-Corasick Algorithm 4: construction of a deterministic finite automaton. */\
+/* The transition function delta is computed for each class of symbols: */\
+/* - the 256 possible values of one byte symbols; */                   \
+/* - for larger symbols, the symbols of the keywords (the alphabet of the machine), and class 0 for all other symbols, */\
+/*   for which delta(s, a) = delta(f(s), a) = ... = 0. */              \
+/* This implements the property LOOP_0 (see ACM_register_keyword) since delta(0, a) is defined for all a. */\
+static int                                                             \
+ACM_compile_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)            \
+{                                                                      \
+  /* Larger symbols are classified by a hash table, with the hash operator of the machine. */\
+  if (sizeof (ACM_SYMBOL) != 1 && !machine->hash)                      \
+    return 0;                                                          \
+  if (machine->transitions)                                            \
+    return 1;                                                          \
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
+  /* Symbols are compared one by one with the equality operator, unless it is the default one on one byte. */\
+  /* The normalizer is applied to the symbols of the text once for all, in the table. */\
+  int bytewise = __EQ_IS_BYTEWISE_##ACM_SYMBOL (machine->eq);          \
+  int exact = bytewise && !machine->normalize;                         \
+  /* Aho-Corasick Algorithm 4: queue <- empty */                       \
+  /* The states are first queued in breadth-first order, so that f(r) is processed before r, */\
+  /* and the alphabet of the machine is collected on the way. */       \
+  size_t queue_length = 0;                                             \
+  ACState_##ACM_SYMBOL **queue = 0;                                    \
+  ACM_ASSERT (queue = malloc (sizeof (*queue) * machine->size));       \
+  queue[queue_length++] = machine->state_0;                            \
+  machine->nb_classes = sizeof (ACM_SYMBOL) == 1 ? 256 : 1;            \
+  for (size_t queue_read_pos = 0; queue_read_pos < queue_length; queue_read_pos++) \
+  {                                                                    \
+    ACState_##ACM_SYMBOL *r = queue[queue_read_pos];                   \
+    /* Aho-Corasick Algorithm 4: queue <- queue U {g(r, a)} */         \
+    for (struct _ac_next_##ACM_SYMBOL *p = r->goto_array; p < r->goto_array + r->nb_goto; p++) \
+    {                                                                  \
+      queue[queue_length++] = p->state;                                \
+      if (sizeof (ACM_SYMBOL) != 1)                                    \
+        machine_alphabet_insert_##ACM_SYMBOL (machine, p->letter);     \
+    }                                                                  \
+  }                                                                    \
+  ACM_ASSERT (queue_length == machine->size);                          \
+  size_t nb_classes = machine->nb_classes;                             \
+  ACM_ASSERT (machine->transitions = malloc (sizeof (*machine->transitions) * nb_classes * machine->size)); \
+  for (size_t queue_read_pos = 0; queue_read_pos < queue_length; queue_read_pos++) \
+  {                                                                    \
+    /* Aho-Corasick Algorithm 4: let r be the next state in queue */   \
+    ACState_##ACM_SYMBOL *r = queue[queue_read_pos];                   \
+    const ACState_##ACM_SYMBOL **delta = machine->transitions + nb_classes * queue_read_pos; \
+    /* Aho-Corasick Algorithm 4: delta(r, a) <- delta(f(r), a) [or 0 if r = 0] for each a such that g(r, a) = fail */\
+    if (r->fail_state)                                                 \
+      memcpy (delta, r->fail_state->transition, sizeof (*delta) * nb_classes); \
+    else                                                               \
+      for (size_t a = 0; a < nb_classes; a++)                          \
+        delta[a] = r;                                                  \
+    /* Aho-Corasick Algorithm 4: delta(r, a) <- g(r, a) for each a such that g(r, a) != fail */\
+    /* goto_array is scanned backward so that the first matching symbol wins, as in state_goto. */\
+    struct _ac_next_##ACM_SYMBOL *begin = r->goto_array;               \
+    for (size_t i = r->nb_goto; i-- > 0;)                              \
+    {                                                                  \
+      struct _ac_next_##ACM_SYMBOL *p = begin + i;                     \
+      if (sizeof (ACM_SYMBOL) != 1)                                    \
+        delta[machine_symbol_class_##ACM_SYMBOL (machine, p->letter)] = p->state; \
+      else if (exact)                                                  \
+        delta[*(const unsigned char *) &p->letter] = p->state;         \
+      else                                                             \
+        for (size_t a = 0; a < 256; a++)                               \
+        {                                                              \
+          ACM_SYMBOL letter;                                           \
+          unsigned char byte = (unsigned char) a;                      \
+          memcpy (&letter, &byte, 1);                                  \
+          letter = NORMALIZE (machine->normalize, letter);             \
+          if (bytewise ? EQ_BYTEWISE (p->letter, letter) : machine->eq (p->letter, letter)) \
+            delta[a] = p->state;                                       \
+        }                                                              \
+    }                                                                  \
+    r->transition = delta;                                             \
+    r->vtable = &(ACS_COMPILED_VTABLE_##ACM_SYMBOL);                   \
+  }                                                                    \
+  free (queue);                                                        \
+  return 1;                                                            \
+}                                                                      \
+\
+/* Builds the flat representation of a frozen machine. */             \
+/* States are numbered in breadth-first order, so that the states close to state 0, the most visited, are packed together. */\
+static int                                                             \
+machine_flatten_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)        \
+{                                                                      \
+  if (machine->size > UINT32_MAX)                                      \
+    return 0;                                                          \
+  struct _ac_flat_##ACM_SYMBOL *flat = malloc (sizeof (*flat));        \
+  ACM_ASSERT (flat);                                                   \
+  ACM_ASSERT (flat->hot = malloc (sizeof (*flat->hot) * machine->size)); \
+  ACM_ASSERT (flat->state = malloc (sizeof (*flat->state) * machine->size)); \
+  flat->edge_letter = 0;                                               \
+  flat->edge_target = 0;                                               \
+  flat->root = 0;                                                      \
+  flat->hash_offset = 0;                                               \
+  flat->hash_table = 0;                                                \
+  flat->nb_hash_slots = 0;                                             \
+  flat->hash = 0;                                                      \
+  flat->cold = 0;                                                      \
+  flat->handle = 0;                                                    \
+  flat->map = 0;                                                       \
+  flat->map_length = 0;                                                \
+  flat->mapped = 0;                                                    \
+  flat->value = 0;                                                     \
+  /* Each state but state 0 is the target of exactly one transition. */\
+  if (machine->size > 1)                                               \
+  {                                                                    \
+    ACM_ASSERT (flat->edge_letter = malloc (sizeof (*flat->edge_letter) * (machine->size - 1))); \
+    ACM_ASSERT (flat->edge_target = malloc (sizeof (*flat->edge_target) * (machine->size - 1))); \
+  }                                                                    \
+  /* Breadth-first traversal, using the array of states as the queue: */\
+  /* the transition to state number n is stored at position n - 1. */  \
+  flat->state[0] = machine->state_0;                                   \
+  machine->state_0->index = 0;                                         \
+  uint32_t nb_states = 1;                                              \
+  for (uint32_t i = 0; i < nb_states; i++)                             \
+  {                                                                    \
+    const ACState_##ACM_SYMBOL *r = flat->state[i];                    \
+    flat->hot[i].first_edge = nb_states - 1;                           \
+    flat->hot[i].nb_goto = (uint32_t) r->nb_goto;                      \
+    flat->hot[i].nb_sequence = (uint32_t) r->nb_sequence;              \
+    struct _ac_next_##ACM_SYMBOL *p = r->goto_array;                   \
+    struct _ac_next_##ACM_SYMBOL *end = p + r->nb_goto;                \
+    for (; p < end; p++)                                               \
+    {                                                                  \
+      p->state->index = nb_states;                                     \
+      flat->edge_letter[nb_states - 1] = p->letter;                    \
+      flat->edge_target[nb_states - 1] = nb_states;                    \
+      flat->state[nb_states++] = p->state;                             \
+    }                                                                  \
+  }                                                                    \
+  ACM_ASSERT (nb_states == machine->size);                             \
+  for (uint32_t i = 0; i < nb_states; i++)                             \
+    flat->hot[i].fail = i ? flat->state[i]->fail_state->index : 0;     \
+  if (machine->root_transition)                                        \
+  {                                                                    \
+    ACM_ASSERT (flat->root = malloc (sizeof (*flat->root) * 256));     \
+    for (size_t a = 0; a < 256; a++)                                   \
+      flat->root[a] = machine->root_transition[a]->index;              \
+  }                                                                    \
+  /* The hash tables of the tree are copied as is, since the transitions of a state keep the order of its goto_array. */\
+  for (uint32_t i = 0; i < nb_states; i++)                             \
+    if (flat->state[i]->goto_hash)                                     \
+      flat->nb_hash_slots += __hash_mask__ (flat->state[i]->nb_goto) + 1; \
+  if (flat->nb_hash_slots && flat->nb_hash_slots <= UINT32_MAX)        \
+  {                                                                    \
+    ACM_ASSERT (flat->hash_offset = calloc (nb_states, sizeof (*flat->hash_offset))); \
+    ACM_ASSERT (flat->hash_table = malloc (sizeof (*flat->hash_table) * flat->nb_hash_slots)); \
+    uint32_t offset = 0;                                               \
+    for (uint32_t i = 0; i < nb_states; i++)                           \
+      if (flat->state[i]->goto_hash)                                   \
+      {                                                                \
+        flat->hash_offset[i] = offset;                                 \
+        for (size_t h = 0; h <= __hash_mask__ (flat->state[i]->nb_goto); h++) \
+          flat->hash_table[offset++] = (uint32_t) flat->state[i]->goto_hash[h]; \
+      }                                                                \
+    flat->hash = machine->hash;                                        \
+  }                                                                    \
+  else                                                                 \
+    flat->nb_hash_slots = 0;                                           \
+  machine->flat = flat;                                                \
+  return 1;                                                            \
+}                                                                      \
+\
+/* Builds the failure function once for all, and freezes the goto function. */\
+static void                                                            \
+ACM_build_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)              \
+{                                                                      \
+  if (machine->frozen)                                                 \
+    return;                                                            \
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
+  machine->frozen = 1;                                                 \
+  /* A compiled machine already matches without checking the failure function. */\
+  if (!machine->transitions)                                           \
+    state_vtable_set_##ACM_SYMBOL (machine->state_0, machine_flatten_##ACM_SYMBOL (machine) ? \
+                                   &(ACS_FLAT_VTABLE_##ACM_SYMBOL) : &(ACS_FROZEN_VTABLE_##ACM_SYMBOL)); \
+}                                                                      \
+\
+/* A chunk of text searched by a thread of ACM_match_parallel. */     \
+struct _ac_parallel_chunk_##ACM_SYMBOL                                 \
+{                                                                      \
+  const ACMachine_##ACM_SYMBOL *machine;                               \
+  const ACM_SYMBOL *text;                                              \
+  size_t start; /* Position of the first searched symbol */            \
+  size_t begin; /* Position of the first symbol of the chunk */        \
+  size_t end;   /* Position past the last symbol of the chunk */       \
+  MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler;                           \
+  void *context;                                                       \
+  size_t nb;    /* Number of matches ending in the chunk */            \
+};                                                                     \
+\
+static void                                                            \
+match_parallel_handler_##ACM_SYMBOL (const ACState_##ACM_SYMBOL * state, size_t i, size_t nb, void *context) \
+{                                                                      \
+  struct _ac_parallel_chunk_##ACM_SYMBOL *chunk = context;             \
+  i += chunk->start;                                                   \
+  /* Matches ending before the chunk are reported by the thread of the previous chunk. */\
+  if (i < chunk->begin)                                                \
+    return;                                                            \
+  chunk->nb += nb;                                                     \
+  if (chunk->handler)                                                  \
+    chunk->handler (state, i, nb, chunk->context);                     \
+}                                                                      \
+\
+static void *                                                          \
+match_parallel_thread_##ACM_SYMBOL (void *arg)                         \
+{                                                                      \
+  struct _ac_parallel_chunk_##ACM_SYMBOL *chunk = arg;                 \
+  const ACState_##ACM_SYMBOL *state = chunk->machine->state_0;         \
+  state->vtable->match_buffer (&state, chunk->text + chunk->start, chunk->end - chunk->start, \
+                               match_parallel_handler_##ACM_SYMBOL, chunk); \
+  return 0;                                                            \
+}                                                                      \
+/* Aho-Corasick Algorithm 1 applied concurrently to chunks of the text. */\
+static size_t                                                          \
+ACM_match_parallel_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, const ACM_SYMBOL * text, size_t length, \
+                                 size_t nb_threads, MATCH_HANDLER_##ACM_SYMBOL##_TYPE handler, void *context) \
+{                                                                      \
+  /* The failure function is built once, before the threads are started. */\
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
+  if (nb_threads > length)                                             \
+    nb_threads = length;                                               \
+  if (!nb_threads)                                                     \
+    nb_threads = 1;                                                    \
+  size_t chunk_length = (length + nb_threads - 1) / nb_threads;        \
+  /* A keyword ending in a chunk starts at most max_depth - 1 symbols before the chunk: */\
+  /* each chunk is searched from there, but only the matches ending in the chunk are reported. */\
+  size_t overlap = machine->max_depth ? machine->max_depth - 1 : 0;    \
+  struct _ac_parallel_chunk_##ACM_SYMBOL *chunks = malloc (sizeof (*chunks) * nb_threads); \
+  pthread_t *threads = malloc (sizeof (*threads) * nb_threads);        \
+  int *started = malloc (sizeof (*started) * nb_threads);              \
+  ACM_ASSERT (chunks && threads && started);                           \
+  for (size_t t = 0; t < nb_threads; t++)                              \
+  {                                                                    \
+    struct _ac_parallel_chunk_##ACM_SYMBOL *chunk = chunks + t;        \
+    chunk->machine = machine;                                          \
+    chunk->text = text;                                                \
+    chunk->begin = t * chunk_length < length ? t * chunk_length : length; \
+    chunk->end = chunk->begin + chunk_length < length ? chunk->begin + chunk_length : length; \
+    chunk->start = chunk->begin > overlap ? chunk->begin - overlap : 0; \
+    chunk->handler = handler;                                          \
+    chunk->context = context;                                          \
+    chunk->nb = 0;                                                     \
+    /* The first chunk is searched by the calling thread, as well as those for which no thread could be created. */\
+    started[t] = t && !pthread_create (threads + t, 0, match_parallel_thread_##ACM_SYMBOL, chunk); \
+  }                                                                    \
+  size_t nb = 0;                                                       \
+  for (size_t t = 0; t < nb_threads; t++)                              \
+  {                                                                    \
+    if (started[t])                                                    \
+      pthread_join (threads[t], 0);                                    \
+    else                                                               \
+      match_parallel_thread_##ACM_SYMBOL (chunks + t);                 \
+    nb += chunks[t].nb;                                                \
+  }                                                                    \
+  free (started);                                                      \
+  free (threads);                                                      \
+  free (chunks);                                                       \
+  return nb;                                                           \
+}                                                                      \
+\
+/* Image of the flat representation of a machine, with offsets instead of pointers: */\
+/* a header followed by the sections located by struct _ac_file_header, as written by ACM_save. */\
+static char *                                                          \
+machine_image_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, size_t * length) \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  uint32_t nb_states = (uint32_t) machine->size;                       \
+  struct _ac_file_header header;                                       \
+  memset (&header, 0, sizeof (header));                                \
+  memcpy (header.magic, ACM_FILE_MAGIC, sizeof (header.magic));        \
+  header.version = ACM_FILE_VERSION;                                   \
+  header.byte_order = ACM_FILE_BYTE_ORDER;                             \
+  strncpy (header.symbol, #ACM_SYMBOL, sizeof (header.symbol) - 1);    \
+  header.symbol_size = sizeof (ACM_SYMBOL);                            \
+  header.word_size = sizeof (size_t);                                  \
+  header.flags = (machine->lt ? ACM_FILE_SORTED : 0) |                 \
+                 (__EQ_IS_BYTEWISE_##ACM_SYMBOL (machine->eq) ? ACM_FILE_BYTEWISE : 0) | \
+                 (flat->hash == __HASH_##ACM_SYMBOL ? ACM_FILE_DEFAULT_HASH : flat->hash ? ACM_FILE_CUSTOM_HASH : 0) | \
+                 (machine->normalize ? ACM_FILE_NORMALIZED : 0);       \
+  header.nb_states = nb_states;                                        \
+  header.nb_keywords = machine->nb_sequence;                           \
+  header.rank = machine->rank;                                         \
+  header.max_depth = machine->max_depth;                               \
+  header.nb_hash_slots = flat->nb_hash_slots;                          \
+  uint64_t offset = __file_align__ (sizeof (header));                  \
+  header.hot = offset;                                                 \
+  offset = __file_align__ (offset + sizeof (*flat->hot) * nb_states);  \
+  header.edge_letter = offset;                                         \
+  offset = __file_align__ (offset + sizeof (*flat->edge_letter) * (nb_states - 1)); \
+  header.edge_target = offset;                                         \
+  offset = __file_align__ (offset + sizeof (*flat->edge_target) * (nb_states - 1)); \
+  header.cold = offset;                                                \
+  offset = __file_align__ (offset + sizeof (struct _ac_mapped_state) * nb_states); \
+  if (flat->root)                                                      \
+  {                                                                    \
+    header.root = offset;                                              \
+    offset = __file_align__ (offset + sizeof (*flat->root) * 256);     \
+  }                                                                    \
+  if (flat->hash)                                                      \
+  {                                                                    \
+    header.hash_offset = offset;                                       \
+    offset = __file_align__ (offset + sizeof (*flat->hash_offset) * nb_states); \
+    header.hash_table = offset;                                        \
+    offset = __file_align__ (offset + sizeof (*flat->hash_table) * flat->nb_hash_slots); \
+  }                                                                    \
+  if (machine->pool)                                                   \
+  {                                                                    \
+    header.pool_length = machine->pool_length;                         \
+    header.pool = offset;                                              \
+    offset = __file_align__ (offset + sizeof (*machine->pool) * machine->pool_length); \
+    header.pool_offset = offset;                                       \
+    offset = __file_align__ (offset + sizeof (*machine->pool_offset) * machine->rank); \
+  }                                                                    \
+  header.length = offset;                                              \
+  char *image = calloc (header.length, 1);                             \
+  ACM_ASSERT (image);                                                  \
+  memcpy (image, &header, sizeof (header));                            \
+  memcpy (image + header.hot, flat->hot, sizeof (*flat->hot) * nb_states); \
+  if (nb_states > 1)                                                   \
+  {                                                                    \
+    memcpy (image + header.edge_letter, flat->edge_letter, sizeof (*flat->edge_letter) * (nb_states - 1)); \
+    memcpy (image + header.edge_target, flat->edge_target, sizeof (*flat->edge_target) * (nb_states - 1)); \
+  }                                                                    \
+  struct _ac_mapped_state *cold = (struct _ac_mapped_state *) (image + header.cold); \
+  for (uint32_t i = 0; i < nb_states; i++)                             \
+  {                                                                    \
+    const ACState_##ACM_SYMBOL *s = flat->state[i];                    \
+    for (uint32_t e = flat->hot[i].first_edge; e < flat->hot[i].first_edge + flat->hot[i].nb_goto; e++) \
+      cold[flat->edge_target[e]].previous = i;                         \
+    cold[i].output = s->output_state ? s->output_state->index : 0;     \
+    cold[i].depth = (uint32_t) s->depth;                               \
+    cold[i].is_matching = s->is_matching ? 1 : 0;                      \
+    cold[i].rank = s->rank;                                            \
+  }                                                                    \
+  if (header.root)                                                     \
+    memcpy (image + header.root, flat->root, sizeof (*flat->root) * 256); \
+  if (flat->hash)                                                      \
+  {                                                                    \
+    memcpy (image + header.hash_offset, flat->hash_offset, sizeof (*flat->hash_offset) * nb_states); \
+    memcpy (image + header.hash_table, flat->hash_table, sizeof (*flat->hash_table) * flat->nb_hash_slots); \
+  }                                                                    \
+  if (machine->pool)                                                   \
+  {                                                                    \
+    memcpy (image + header.pool, machine->pool, sizeof (*machine->pool) * machine->pool_length); \
+    memcpy (image + header.pool_offset, machine->pool_offset, sizeof (*machine->pool_offset) * machine->rank); \
+  }                                                                    \
+  *length = header.length;                                             \
+  return image;                                                        \
+}                                                                      \
+\
+/* Writes the image of a frozen machine to a file (see ACM_load_mapped). */\
+static int                                                             \
+ACM_save_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, const char *path) \
+{                                                                      \
+  /* Symbols with a copy constructor hold resources (such as pointers) which can not be written to a file. */\
+  if (!machine->frozen || machine->copy != __COPY_##ACM_SYMBOL || COPY_##ACM_SYMBOL || \
+      (size_t) 0 != (size_t) (COPY_DEFAULT (ACM_SYMBOL)))              \
+    return 0;                                                          \
+  /* A compiled machine has no flat representation: it is built for the time of the save. */\
+  int temporary = !machine->flat;                                      \
+  if (temporary && !machine_flatten_##ACM_SYMBOL ((ACMachine_##ACM_SYMBOL *) machine)) \
+    return 0;                                                          \
+  size_t length;                                                       \
+  char *image = machine_image_##ACM_SYMBOL (machine, &length);         \
+  if (temporary)                                                       \
+    machine_flat_release_##ACM_SYMBOL ((ACMachine_##ACM_SYMBOL *) machine); \
+  int ok = __file_save__ (path, image, length);                        \
+  free (image);                                                        \
+  return ok;                                                           \
+}                                                                      \
+\
+/* A mapped machine is frozen: it has no tree of states, and is searched on its flat representation in the mapped file. */\
+static int                                                             \
+ACM_is_registered_keyword_mapped_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, \
+                                               Keyword_##ACM_SYMBOL sequence, void **value) \
+{                                                                      \
+  const struct _ac_flat_##ACM_SYMBOL *flat = machine->flat;            \
+  uint32_t state = 0; /* [state 0] */                                  \
+  for (size_t j = 0; j < sequence.length && (!j || state); j++)        \
+    state = flat_next_##ACM_SYMBOL (flat, state, NORMALIZE (machine->normalize, sequence.letter[j]), \
+                                    machine->eq, machine->lt);         \
+  if (!state || !flat->cold[state].is_matching)                        \
+    return 0;                                                          \
+  if (value)                                                           \
+    *value = flat->value ? flat->value[state] : 0;                     \
+  return 1;                                                            \
+}                                                                      \
+\
+static void                                                            \
+foreach_keyword_mapped_##ACM_SYMBOL (const struct _ac_flat_##ACM_SYMBOL * flat, uint32_t state, \
+                                     ACM_SYMBOL ** letters, size_t * length, size_t depth, \
+                                     void (*operator) (MatchHolder_##ACM_SYMBOL, void *)) \
+{                                                                      \
+  if (flat->cold[state].is_matching && depth)                          \
+  {                                                                    \
+    MatchHolder_##ACM_SYMBOL k = {.letter = *letters,.length = depth, .rank = flat->cold[state].rank }; \
+    (*operator) (k, flat->value ? flat->value[state] : 0);             \
+  }                                                                    \
+  const struct _ac_hot_state_##ACM_SYMBOL *hot = flat->hot + state;    \
+  if (hot->nb_goto && depth >= *length)                                \
+  {                                                                    \
+    (*length)++;                                                       \
+    *letters = realloc (*letters, sizeof (**letters) * (*length));     \
+    ACM_ASSERT (*letters);                                             \
+  }                                                                    \
+  for (uint32_t e = hot->first_edge; e < hot->first_edge + hot->nb_goto; e++) \
+  {                                                                    \
+    (*letters)[depth] = flat->edge_letter[e];                          \
+    foreach_keyword_mapped_##ACM_SYMBOL (flat, flat->edge_target[e], letters, length, depth + 1, operator); \
+  }                                                                    \
+}                                                                      \
+\
+static void                                                            \
+ACM_foreach_keyword_mapped_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, \
+                                         void (*operator) (MatchHolder_##ACM_SYMBOL, void *)) \
+{                                                                      \
+  if (!operator)                                                       \
+    return;                                                            \
+  ACM_SYMBOL *letters = 0;                                             \
+  size_t depth = 0;                                                    \
+  foreach_keyword_mapped_##ACM_SYMBOL (machine->flat, 0, &letters, &depth, 0, operator); \
+  free (letters);                                                      \
+}                                                                      \
+\
+static void                                                            \
+ACM_release_mapped_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  machine_flat_release_##ACM_SYMBOL ((ACMachine_##ACM_SYMBOL *) machine); \
+  pthread_mutex_destroy (&((ACMachine_##ACM_SYMBOL *) machine)->lock); \
+  pthread_mutex_destroy (&((ACMachine_##ACM_SYMBOL *) machine)->retired_lock); \
+  free ((ACMachine_##ACM_SYMBOL *) machine);                           \
+}                                                                      \
+\
+static void                                                            \
+ACM_print_mapped_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine, FILE * stream, PRINT_##ACM_SYMBOL##_TYPE printer) \
+{                                                                      \
+  /* There is no tree of states to print. */                           \
+  (void) machine;                                                      \
+  (void) stream;                                                       \
+  (void) printer;                                                      \
+}                                                                      \
+\
+static int                                                             \
+ACM_compile_mapped_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)     \
+{                                                                      \
+  /* The transitions are read in the image. */                         \
+  (void) machine;                                                      \
+  return 0;                                                            \
+}                                                                      \
+/* The image is written as is. */                                      \
+static int                                                             \
+ACM_save_mapped_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine, const char *path) \
+{                                                                      \
+  return __file_save__ (path, machine->flat->map, machine->flat->map_length); \
+}                                                                      \
+\
+static int                                                             \
+ACM_publish_mapped_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)     \
+{                                                                      \
+  /* A mapped machine is already immutable. */                         \
+  (void) machine;                                                      \
+  return 0;                                                            \
+}                                                                      \
+/* The pool of keywords, if any, is read in the image. */              \
+static int                                                             \
+ACM_pool_keywords_mapped_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  return machine->pool != 0;                                           \
+}                                                                      \
+\
+static const ACMachine_##ACM_SYMBOL *                                  \
+ACM_snapshot_mapped_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  (void) machine;                                                      \
+  return 0;                                                            \
+}                                                                      \
+\
+static const struct _acm_vtable_##ACM_SYMBOL ACM_MAPPED_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_register_keyword_##ACM_SYMBOL,                                   \
+  ACM_register_keywords_##ACM_SYMBOL,                                  \
+  ACM_is_registered_keyword_mapped_##ACM_SYMBOL,                       \
+  ACM_unregister_keyword_##ACM_SYMBOL,                                 \
+  ACM_nb_keywords_##ACM_SYMBOL,                                        \
+  ACM_foreach_keyword_mapped_##ACM_SYMBOL,                             \
+  ACM_release_mapped_##ACM_SYMBOL,                                     \
+  ACM_reset_##ACM_SYMBOL,                                              \
+  ACM_print_mapped_##ACM_SYMBOL,                                       \
+  ACM_compile_mapped_##ACM_SYMBOL,                                     \
+  ACM_build_##ACM_SYMBOL,                                              \
+  ACM_match_parallel_##ACM_SYMBOL,                                     \
+  ACM_save_mapped_##ACM_SYMBOL,                                        \
+  ACM_publish_mapped_##ACM_SYMBOL,                                     \
+  ACM_snapshot_mapped_##ACM_SYMBOL,                                    \
+  ACM_pool_keywords_mapped_##ACM_SYMBOL,                               \
+};                                                                     \
+\
+/* Snapshots replaced by a later one are reclaimed, oldest first, once no reader holds them: */\
+/* a reader which got a replaced snapshot from ACM_snapshot has either counted its reference already, */\
+/* or is still counted in nb_acquiring. */                             \
+/* Called by the writer after each publication, and by a reader which released the last reference to a snapshot. */\
+static void                                                            \
+machine_snapshot_reclaim_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine) \
+{                                                                      \
+  pthread_mutex_lock (&machine->retired_lock);                         \
+  if (!__atomic_load_n (&machine->nb_acquiring, __ATOMIC_SEQ_CST))     \
+    while (machine->retired && !__atomic_load_n (&machine->retired->nb_references, __ATOMIC_SEQ_CST)) \
+    {                                                                  \
+      ACMachine_##ACM_SYMBOL *snapshot = machine->retired;             \
+      machine->retired = snapshot->retired;                            \
+      machine_snapshot_free_##ACM_SYMBOL (snapshot);                   \
+    }                                                                  \
+  pthread_mutex_unlock (&machine->retired_lock);                       \
+}                                                                      \
+\
+/* A snapshot is released by its readers, and reclaimed by the machine which published it (see machine_snapshot_reclaim). */\
+static void                                                            \
+ACM_release_snapshot_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * snapshot) \
+{                                                                      \
+  /* The snapshot can be reclaimed by another thread as soon as its count of references is 0. */\
+  ACMachine_##ACM_SYMBOL *publisher = snapshot->publisher;             \
+  if (!__atomic_sub_fetch (&((ACMachine_##ACM_SYMBOL *) snapshot)->nb_references, 1, __ATOMIC_SEQ_CST)) \
+    machine_snapshot_reclaim_##ACM_SYMBOL (publisher);                 \
+}                                                                      \
+\
+static const struct _acm_vtable_##ACM_SYMBOL ACM_SNAPSHOT_VTABLE_##ACM_SYMBOL = \
+{                                                                      \
+  ACM_register_keyword_##ACM_SYMBOL,                                   \
+  ACM_register_keywords_##ACM_SYMBOL,                                  \
+  ACM_is_registered_keyword_mapped_##ACM_SYMBOL,                       \
+  ACM_unregister_keyword_##ACM_SYMBOL,                                 \
+  ACM_nb_keywords_##ACM_SYMBOL,                                        \
+  ACM_foreach_keyword_mapped_##ACM_SYMBOL,                             \
+  ACM_release_snapshot_##ACM_SYMBOL,                                   \
+  ACM_reset_##ACM_SYMBOL,                                              \
+  ACM_print_mapped_##ACM_SYMBOL,                                       \
+  ACM_compile_mapped_##ACM_SYMBOL,                                     \
+  ACM_build_##ACM_SYMBOL,                                              \
+  ACM_match_parallel_##ACM_SYMBOL,                                     \
+  ACM_save_mapped_##ACM_SYMBOL,                                        \
+  ACM_publish_mapped_##ACM_SYMBOL,                                     \
+  ACM_snapshot_mapped_##ACM_SYMBOL,                                    \
+  ACM_pool_keywords_mapped_##ACM_SYMBOL,                               \
+};                                                                     \
+\
+/* A frozen machine reading its flat representation in place in an image (see machine_image), */\
+/* either mapped from a file, or allocated. */                         \
+/* hash is the hash operator the hash tables of the image were built with, if known. */\
+static ACMachine_##ACM_SYMBOL *                                        \
+machine_image_load_##ACM_SYMBOL (char *image, size_t length, int mapped, \
+                                 EQ_##ACM_SYMBOL##_TYPE eq, LT_##ACM_SYMBOL##_TYPE lt, \
+                                 HASH_##ACM_SYMBOL##_TYPE hash)        \
+{                                                                      \
+  const struct _ac_file_header *header = (const struct _ac_file_header *) image; \
+  ACMachine_##ACM_SYMBOL *machine = malloc (sizeof (*machine));        \
+  struct _ac_flat_##ACM_SYMBOL *flat = malloc (sizeof (*flat));        \
+  /* Only the pages of the states actually reached by the searches are touched. */\
+  ACState_##ACM_SYMBOL *handle = calloc (header->nb_states, sizeof (*handle)); \
+  ACM_ASSERT (machine && flat && handle);                              \
+  flat->hot = (struct _ac_hot_state_##ACM_SYMBOL *) (image + header->hot); \
+  flat->edge_letter = (ACM_SYMBOL *) (image + header->edge_letter);    \
+  flat->edge_target = (uint32_t *) (image + header->edge_target);      \
+  flat->cold = (const struct _ac_mapped_state *) (image + header->cold); \
+  flat->root = 0;                                                      \
+  flat->hash_offset = 0;                                               \
+  flat->hash_table = 0;                                                \
+  flat->nb_hash_slots = 0;                                             \
+  flat->hash = 0;                                                      \
+  flat->state = 0;                                                     \
+  flat->handle = handle;                                               \
+  flat->map = image;                                                   \
+  flat->map_length = length;                                           \
+  flat->mapped = mapped;                                               \
+  flat->value = 0;                                                     \
+  machine_init_##ACM_SYMBOL (machine, handle, eq, 0, 0, lt);           \
+  machine->vtable = &(ACM_MAPPED_VTABLE_##ACM_SYMBOL);                 \
+  /* Binary search is only used if the transitions were sorted. */     \
+  if (!(header->flags & ACM_FILE_SORTED))                              \
+    machine->lt = 0;                                                   \
+  /* The index of state 0 was built for symbols compared byte per byte: it is only used with the same equality. */\
+  if ((header->flags & ACM_FILE_BYTEWISE) && __EQ_IS_BYTEWISE_##ACM_SYMBOL (machine->eq)) \
+  {                                                                    \
+    if (header->root)                                                  \
+      flat->root = (uint32_t *) (image + header->root);                \
+  }                                                                    \
+  /* The hash tables are only used with the hash operator of the machine, if it is the one they were built with. */\
+  if (header->hash_table && hash && hash == machine->hash)             \
+  {                                                                    \
+    flat->hash_offset = (uint32_t *) (image + header->hash_offset);    \
+    flat->hash_table = (uint32_t *) (image + header->hash_table);      \
+    flat->nb_hash_slots = (size_t) header->nb_hash_slots;              \
+    flat->hash = hash;                                                 \
+  }                                                                    \
+  machine->flat = flat;                                                \
+  machine->frozen = 1;                                                 \
+  machine->reconstruct = 0;                                            \
+  machine->size = header->nb_states;                                   \
+  machine->max_depth = (size_t) header->max_depth;                     \
+  machine->rank = (size_t) header->rank;                               \
+  machine->nb_sequence = (size_t) header->nb_keywords;                 \
+  if (header->pool)                                                    \
+  {                                                                    \
+    machine->pool = (ACM_SYMBOL *) (image + header->pool);             \
+    machine->pool_offset = (size_t *) (image + header->pool_offset);   \
+    machine->pool_length = (size_t) header->pool_length;               \
+  }                                                                    \
+  machine_root_bytes_##ACM_SYMBOL (machine);                           \
+  handle->vtable = &(ACS_MAPPED_VTABLE_##ACM_SYMBOL);                  \
+  return machine;                                                      \
+}                                                                      \
+\
+/* Loads a machine saved by ACM_save: its flat representation is read in place in the mapped file. */\
+__attribute__ ((unused)) ACMachine_##ACM_SYMBOL *ACM_load_mapped_##ACM_SYMBOL (const char *path, \
+                                                 EQ_##ACM_SYMBOL##_TYPE eq, \
+                                                 LT_##ACM_SYMBOL##_TYPE lt) \
+{                                                                      \
+  size_t length;                                                       \
+  const struct _ac_file_header *header = __file_map__ (path, #ACM_SYMBOL, sizeof (ACM_SYMBOL), &length); \
+  if (!header)                                                         \
+    return 0;                                                          \
+  /* The texts must be normalized as the keywords were, and the hash tables read with the operator they were built with. */\
+  if (!(header->flags & ACM_FILE_NORMALIZED) != !NORM_##ACM_SYMBOL ||  \
+      ((header->flags & ACM_FILE_CUSTOM_HASH) && !HASH_##ACM_SYMBOL) || \
+      ((header->flags & ACM_FILE_DEFAULT_HASH) && HASH_##ACM_SYMBOL))  \
+  {                                                                    \
+    munmap ((void *) header, length);                                  \
+    return 0;                                                          \
+  }                                                                    \
+  return machine_image_load_##ACM_SYMBOL ((char *) header, length, 1, eq, lt, \
+                                          (header->flags & ACM_FILE_CUSTOM_HASH) ? HASH_##ACM_SYMBOL : \
+                                          (header->flags & ACM_FILE_DEFAULT_HASH) ? __HASH_##ACM_SYMBOL : 0); \
+}                                                                      \
+\
+/* Read-copy-update: the flat representation of the machine is copied into an immutable snapshot, */\
+/* which is then published at once in place of the previous one. */    \
+static int                                                             \
+ACM_publish_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL * machine)            \
+{                                                                      \
+  /* The symbols of the snapshot are copied byte per byte (see ACM_save). */\
+  if (machine->copy != __COPY_##ACM_SYMBOL || COPY_##ACM_SYMBOL || (size_t) 0 != (size_t) (COPY_DEFAULT (ACM_SYMBOL))) \
+    return 0;                                                          \
+  machine_fail_state_update_##ACM_SYMBOL (machine);                    \
+  int temporary = !machine->flat;                                      \
+  if (temporary && !machine_flatten_##ACM_SYMBOL (machine))            \
+    return 0;                                                          \
+  size_t length;                                                       \
+  char *image = machine_image_##ACM_SYMBOL (machine, &length);         \
+  void **value = malloc (sizeof (*value) * machine->size);             \
+  ACM_ASSERT (value);                                                  \
+  for (size_t i = 0; i < machine->size; i++)                           \
+    value[i] = machine->flat->state[i]->value;                         \
+  HASH_##ACM_SYMBOL##_TYPE hash = machine->flat->hash;                 \
+  if (temporary)                                                       \
+    machine_flat_release_##ACM_SYMBOL (machine);                       \
+  ACMachine_##ACM_SYMBOL *snapshot = machine_image_load_##ACM_SYMBOL (image, length, 0, machine->eq, machine->lt, hash); \
+  snapshot->flat->value = value;                                       \
+  snapshot->normalize = machine->normalize;                            \
+  snapshot->is_word = machine->is_word;                                \
+  /* The symbols skipped to from state 0 depend on the normalizer. */  \
+  machine_root_bytes_##ACM_SYMBOL (snapshot);                          \
+  snapshot->vtable = &(ACM_SNAPSHOT_VTABLE_##ACM_SYMBOL);              \
+  snapshot->publisher = machine;                                       \
+  ACMachine_##ACM_SYMBOL *previous = __atomic_exchange_n (&machine->snapshot, snapshot, __ATOMIC_SEQ_CST); \
+  if (previous)                                                        \
+  {                                                                    \
+    /* The values released since the previous snapshot was published can still be read by its readers. */\
+    previous->retired_values = machine->retired_values;                \
+    machine->retired_values = 0;                                       \
+    pthread_mutex_lock (&machine->retired_lock);                       \
+    ACMachine_##ACM_SYMBOL **last = &machine->retired;                 \
+    while (*last)                                                      \
+      last = &(*last)->retired;                                        \
+    *last = previous;                                                  \
+    pthread_mutex_unlock (&machine->retired_lock);                     \
+  }                                                                    \
+  machine_snapshot_reclaim_##ACM_SYMBOL (machine);                     \
+  return 1;                                                            \
+}                                                                      \
+\
+static const ACMachine_##ACM_SYMBOL *                                  \
+ACM_snapshot_##ACM_SYMBOL (const ACMachine_##ACM_SYMBOL * machine)     \
+{                                                                      \
+  ACMachine_##ACM_SYMBOL *m = (ACMachine_##ACM_SYMBOL *) machine;      \
+  __atomic_add_fetch (&m->nb_acquiring, 1, __ATOMIC_SEQ_CST);          \
+  ACMachine_##ACM_SYMBOL *snapshot = __atomic_load_n (&m->snapshot, __ATOMIC_SEQ_CST); \
+  if (snapshot)                                                        \
+    __atomic_add_fetch (&snapshot->nb_references, 1, __ATOMIC_SEQ_CST); \
+  __atomic_sub_fetch (&m->nb_acquiring, 1, __ATOMIC_SEQ_CST);          \
+  return snapshot;                                                     \
+}                                                                      \
+\
 static const struct _acm_vtable_##ACM_SYMBOL ACM_VTABLE_##ACM_SYMBOL = \
 {                                                                      \
   ACM_register_keyword_##ACM_SYMBOL,                                   \
+  ACM_register_keywords_##ACM_SYMBOL,                                  \
   ACM_is_registered_keyword_##ACM_SYMBOL,                              \
   ACM_unregister_keyword_##ACM_SYMBOL,                                 \
   ACM_nb_keywords_##ACM_SYMBOL,                                        \
@@ -781,6 +3177,13 @@ static const struct _acm_vtable_##ACM_SYMBOL ACM_VTABLE_##ACM_SYMBOL = \
   ACM_release_##ACM_SYMBOL,                                            \
   ACM_reset_##ACM_SYMBOL,                                              \
   ACM_print_##ACM_SYMBOL,                                              \
+  ACM_compile_##ACM_SYMBOL,                                            \
+  ACM_build_##ACM_SYMBOL,                                              \
+  ACM_match_parallel_##ACM_SYMBOL,                                     \
+  ACM_save_##ACM_SYMBOL,                                               \
+  ACM_publish_##ACM_SYMBOL,                                            \
+  ACM_snapshot_##ACM_SYMBOL,                                           \
+  ACM_pool_keywords_##ACM_SYMBOL,                                      \
 };                                                                     \
                                                                        \
 static void                                                            \
@@ -788,18 +3191,45 @@ machine_init_##ACM_SYMBOL (ACMachine_##ACM_SYMBOL *machine,            \
                              ACState_##ACM_SYMBOL * state_0,           \
                              EQ_##ACM_SYMBOL##_TYPE eq,                \
                              COPY_##ACM_SYMBOL##_TYPE copier,          \
-                             DESTROY_##ACM_SYMBOL##_TYPE dtor)         \
+                             DESTROY_##ACM_SYMBOL##_TYPE dtor,         \
+                             LT_##ACM_SYMBOL##_TYPE lt)                \
 {                                                                      \
   machine->reconstruct = 1; /* f(s) is undefined and has not been computed yet */\
   machine->size = 1;                                                   \
+  machine->max_depth = 0;                                              \
+  machine->nb_build_threads = 1;                                       \
+  machine->transitions = 0;                                            \
+  machine->alphabet = 0;                                               \
+  machine->alphabet_hash = 0;                                          \
+  machine->alphabet_hash_mask = machine->nb_classes = 0;               \
+  machine->root_transition = 0;                                        \
+  machine->nb_root_bytes = 0;                                          \
+  machine->flat = 0;                                                   \
+  machine->frozen = 0;                                                 \
+  __arena_init__ (&machine->arena);                                    \
+  machine->nb_value_dtor = 0;                                          \
+  machine->snapshot = machine->retired = 0;                            \
+  machine->retired_values = 0;                                         \
+  machine->nb_acquiring = machine->nb_references = 0;                  \
+  machine->publisher = 0;                                              \
+  machine->pool = 0;                                                   \
+  machine->pool_offset = 0;                                            \
+  machine->pool_length = machine->pool_size = machine->pool_nb_offsets = 0; \
   machine->state_0 = state_0;                                          \
   state_0->machine = machine;                                          \
   machine->rank = machine->nb_sequence = machine->state_counter = 0;   \
   pthread_mutex_init (&machine->lock, 0);                              \
+  pthread_mutex_init (&machine->retired_lock, 0);                      \
   machine->vtable = &(ACM_VTABLE_##ACM_SYMBOL);                        \
   machine->copy = copier ? copier : __COPY_##ACM_SYMBOL;               \
   machine->destroy = dtor ? dtor : __DTOR_##ACM_SYMBOL;                \
   machine->eq = eq ? eq : __EQ_##ACM_SYMBOL;                           \
+  /* The order of goto_array and the normalizer are set once for all on creation of the machine. */\
+  machine->lt = lt ? lt : LT_##ACM_SYMBOL;                             \
+  machine->normalize = NORM_##ACM_SYMBOL;                              \
+  machine->is_word = WORD_##ACM_SYMBOL;                                \
+  /* The hash operator must be consistent with the equality operator: the default one only is for symbols compared byte per byte. */\
+  machine->hash = HASH_##ACM_SYMBOL ? HASH_##ACM_SYMBOL : __EQ_IS_BYTEWISE_##ACM_SYMBOL (machine->eq) ? __HASH_##ACM_SYMBOL : 0; \
 }                                                                      \
 struct __useless_struct_to_allow_trailing_semicolon__##T##__
 // END DEFINE_ACM
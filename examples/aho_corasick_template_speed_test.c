@@ -18,6 +18,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "aho_corasick_template_impl.h"
 
 ACM_DECLARE (char);
@@ -32,6 +33,18 @@ print_match (MatchHolder (char) match, void *value)
   printf ("'=%i}", *(int *) value);
 }
 
+static void
+count_keyword (size_t rank, size_t length, void *value, void *context)
+{
+  (*(int *) value)++;
+}
+
+static void
+count_match (const ACState (char) * state, size_t position, size_t nb, void *context)
+{
+  ACM_foreach_match (state, count_keyword);
+}
+
 int
 main (void)
 {
@@ -44,6 +57,9 @@ main (void)
   ACM_KEYWORD_SET (kw, "1985", 4);
   ACM_register_keyword (M, kw, calloc (1, sizeof (int)), free);
 
+  // Symbols of type char fit in a dense transition table.
+  ACM_compile (M);
+
   FILE *f = fopen ("googlebooks-eng-all-1gram-20120701-0", "r");
   if (f == 0)
   {
@@ -54,21 +70,13 @@ main (void)
   }
 
   const ACState (char) * state = ACM_reset (M);
-  char line[4096];
-  while (fgets (line, sizeof (line) / sizeof (*line), f))
-    for (char *c = line; *c; c++)
-    {
-      size_t nb = ACM_match (state, *c);
-      // For performance reasons, the third optional argument of ACM_match avoids the euivalent but slower call to ACM_nb_matches.
-      // size_t nb = ACM_nb_matches (state);
-
-      for (size_t j = 0; j < nb; j++)
-      {
-        void *v;
-        ACM_get_match (state, j, 0, &v);
-        (*(int *) v)++;
-      }
-    }
+  static char buffer[1 << 16];
+  size_t length;
+  // The file is parsed in large consecutive buffers: the search goes on from one buffer to the next.
+  while ((length = fread (buffer, sizeof (*buffer), sizeof (buffer) / sizeof (*buffer), f)))
+    // ACM_match_buffer avoids a call to ACM_match for each symbol: count_match is only called where keywords match,
+    // and the text is skipped with memchr up to the next '1' while at state 0.
+    ACM_match_buffer (state, buffer, length, count_match);
   fclose (f);
 
   ACM_foreach_keyword (M, print_match);
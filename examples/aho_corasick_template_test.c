@@ -18,11 +18,16 @@
 */
 
 #include <stdio.h>
+// The checks below call the functions under test inside assert: they must not be compiled out.
+#undef NDEBUG
 #include <assert.h>
+#include <ctype.h>
 #include <wctype.h>
 #include <wchar.h>
 #include <locale.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 // 1. Insert "aho_corasick_template_impl.h" in global scope.
 #include "aho_corasick_template_impl.h"
@@ -31,6 +36,10 @@
 /* *INDENT-OFF* */
 ACM_DECLARE (wchar_t);
 ACM_DEFINE (wchar_t);
+ACM_DECLARE (char);
+ACM_DEFINE (char);
+ACM_DECLARE (size_t);
+ACM_DEFINE (size_t);
 /* *INDENT-ON* */
 
 static int words;
@@ -44,6 +53,33 @@ nocaseeq (wchar_t k, wchar_t t)
   return k == towlower (t);
 }
 
+// User defined word symbols, for whole word matching without padding (see SET_WORD_OPERATOR):
+static int
+alphawchar (wchar_t c)
+{
+  return iswalpha (c);
+}
+
+static int
+alphachar (char c)
+{
+  return isalpha ((unsigned char) c);
+}
+
+static size_t *word_counts;     // Number of occurrences of the words, by rank, found by ACM_match_records.
+
+static void
+count_word (MatchRecord (wchar_t) record, void *context)
+{
+  word_counts[record.rank]++;
+}
+
+static void
+check_word_count (MatchHolder (wchar_t) match, void *value)
+{
+  assert (*(size_t *) value == word_counts[ACM_MATCH_UID (match)]);
+}
+
 // User defined alphabet only comparison:
 static int
 alphaeq (wchar_t k, wchar_t t)
@@ -61,6 +97,189 @@ alphaeq (wchar_t k, wchar_t t)
   return k == towlower (t);
 }
 
+static int
+nocaseeqchar (char k, char t)
+{
+  return k == tolower (t);
+}
+
+// User defined ordering consistent with nocaseeqchar:
+static int
+nocaseltchar (char k, char t)
+{
+  return k < tolower (t);
+}
+
+// User defined normalizer, applied once per symbol, for case insensitive matching with the default equality:
+static char
+lowerchar (char c)
+{
+  return tolower (c);
+}
+
+static wchar_t
+lowerwchar (wchar_t c)
+{
+  return towlower (c);
+}
+
+// User defined equality, ordering and hash operators, consistent with each other:
+static int
+wchareq (wchar_t k, wchar_t t)
+{
+  return k == t;
+}
+
+static int
+wcharlt (wchar_t k, wchar_t t)
+{
+  return k < t;
+}
+
+static size_t
+wcharhash (wchar_t c)
+{
+  return (size_t) c * 2654435761u;
+}
+
+static void
+check_match (size_t rank, size_t length, void *value, void *context)
+{
+  // Matches are visited in the order of ACM_get_match.
+  const ACState (char) * state = *(const ACState (char) **) context;
+  MatchHolder (char) match;
+  ACM_MATCH_INIT (match);
+  assert (ACM_get_match (state, current_pos++, &match) == rank);
+  assert (ACM_MATCH_LENGTH (match) == length);
+  ACM_MATCH_RELEASE (match);
+}
+
+static void
+sum_positions (const ACState (char) * state, size_t i, size_t nb, void *context)
+{
+  // Called concurrently by ACM_match_parallel.
+  __atomic_add_fetch ((size_t *) context, (i + 1) * nb, __ATOMIC_RELAXED);
+}
+
+static void
+check_values (const ACState (char) * state, size_t i, size_t nb, void *context)
+{
+  // The value associated to each keyword is its length, still readable in a snapshot after the keyword was unregistered.
+  MatchHolder (char) match;
+  ACM_MATCH_INIT (match);
+  for (size_t j = 0; j < nb; j++)
+  {
+    void *value = 0;
+    ACM_get_match (state, j, &match, &value);
+    assert (value && *(size_t *) value == ACM_MATCH_LENGTH (match));
+    // The pool of keywords is published with the snapshot.
+    MatchView (char) view;
+    assert (ACM_get_match_view (state, j, &view) == ACM_MATCH_UID (match));
+    assert (ACM_MATCH_SYMBOLS (view) && ACM_MATCH_LENGTH (view) == ACM_MATCH_LENGTH (match));
+    assert (!memcmp (ACM_MATCH_SYMBOLS (view), ACM_MATCH_SYMBOLS (match), ACM_MATCH_LENGTH (match)));
+  }
+  ACM_MATCH_RELEASE (match);
+}
+
+struct match_records
+{
+  MatchRecord (char) records[64];
+  size_t nb_records;
+};
+
+static void
+add_record (MatchRecord (char) record, void *context)
+{
+  struct match_records *records = context;
+  assert (records->nb_records < sizeof (records->records) / sizeof (*records->records));
+  records->records[records->nb_records++] = record;
+}
+
+// Non-overlapping matches of keywords (of ranks 0 to nb_keywords - 1) in text, found by brute force:
+// the leftmost match, the longest one (mode ACM_MATCH_LEFTMOST_LONGEST) or the first registered one, then the leftmost after it...
+static size_t
+leftmost_matches (const char *text, char **keywords, size_t nb_keywords, int mode, MatchRecord (char) * records)
+{
+  size_t nb = 0;
+  for (size_t start = 0; text[start];)
+  {
+    size_t found = nb_keywords;
+    for (size_t i = 0; i < nb_keywords; i++)
+    {
+      size_t length = strlen (keywords[i]), j = 0;
+      while (j < length && text[start + j] && nocaseeqchar (keywords[i][j], text[start + j]))
+        j++;
+      if (j == length && (found == nb_keywords || (mode == ACM_MATCH_LEFTMOST_LONGEST && length > strlen (keywords[found]))))
+        found = i;
+    }
+    if (found == nb_keywords)
+      start++;
+    else
+    {
+      MatchRecord (char) record = { start, start + strlen (keywords[found]), found, 0 };
+      records[nb++] = record;
+      start = record.end;
+    }
+  }
+  return nb;
+}
+
+static size_t nb_destroyed;
+
+static void
+count_destroyed (void *value)
+{
+  nb_destroyed++;
+  free (value);
+}
+
+// Overwrites the 32 bits integer at position index of the section of a saved file starting at offset (see ACM_save).
+static void
+corrupt_file (const char *path, uint64_t offset, size_t index, uint32_t value)
+{
+  FILE *f = fopen (path, "r+b");
+  assert (f);
+  assert (!fseek (f, (long) (offset + index * sizeof (value)), SEEK_SET));
+  assert (fwrite (&value, sizeof (value), 1, f) == 1);
+  assert (!fclose (f));
+}
+
+static struct _ac_file_header
+read_file_header (const char *path)
+{
+  struct _ac_file_header header;
+  FILE *f = fopen (path, "rb");
+  assert (f);
+  assert (fread (&header, sizeof (header), 1, f) == 1);
+  assert (!fclose (f));
+  return header;
+}
+
+struct snapshot_reader
+{
+  const ACMachine (char) * machine;
+  const char *text;
+  size_t nb_matches[2];         // Number of matches for each of the two sets of keywords published in turn.
+  int stop;
+};
+
+static void *
+read_snapshots (void *arg)
+{
+  struct snapshot_reader *reader = arg;
+  while (!__atomic_load_n (&reader->stop, __ATOMIC_SEQ_CST))
+  {
+    const ACMachine (char) * S = ACM_snapshot (reader->machine);
+    assert (S);
+    const ACState (char) * s = ACM_reset (S);
+    size_t nb = ACM_match_buffer (s, reader->text, strlen (reader->text), check_values);
+    // Updates are seen all at once, or not at all.
+    assert (nb == reader->nb_matches[0] || nb == reader->nb_matches[1]);
+    ACM_release (S);
+  }
+  return 0;
+}
+
 static void
 print_keyword (Keyword (wchar_t) kw)
 {
@@ -264,6 +483,10 @@ main (void)
   // 4. Initialize a state machine of type ACMachine (T) using ACM_create (T)
   //    An optional second argument of type EQ_OPERATOR_TYPE(*T*) can specify a user defined equality operator.
   M = ACM_create (wchar_t, alphaeq);
+  // W finds the same whole words, registered without padding, thanks to a word operator.
+  SET_WORD_OPERATOR (wchar_t, alphawchar);
+  ACMachine (wchar_t) * W = ACM_create (wchar_t, nocaseeq);
+  SET_WORD_OPERATOR (wchar_t, 0);
 
   clock_t myclock = clock ();
   while (fgetws (line + 1, sizeof (line) / sizeof (*line) - 1, stream))
@@ -287,15 +510,42 @@ main (void)
     // Initialize the value associated to the keyword.
     *v = 0;
     ACM_register_keyword (M, k, v, free);
+    ACM_KEYWORD_SET (k, line + 1, wcslen (line) - 2);
+    ACM_register_keyword (W, k);
   }
   printf ("Elapsed CPU time for processing keywords: %f s.\n", (clock () - myclock) * 1.0 / CLOCKS_PER_SEC);
 
   fclose (stream);
 
+  // Once all keywords are registered, the machine can be frozen: the failure function is built once for all,
+  // here with several threads.
+  ACM_set_build_threads (M, 4);
+  ACM_build (M);
+  {
+    /* *INDENT-OFF* */
+    Keyword (wchar_t) kw = {.letter = L" woolf ",.length = 7};
+    /* *INDENT-ON* */
+    assert (ACM_is_registered_keyword (M, kw, 0));
+    assert (!ACM_unregister_keyword (M, kw));
+  }
+
+  // A frozen machine can be saved to a file, and loaded back by mapping the file in memory.
+  // P is searched along with M, and must find the same keywords.
+  char path[] = "/tmp/aho_corasick_template_test_XXXXXX";
+  int fd = mkstemp (path);
+  assert (fd >= 0);
+  close (fd);
+  assert (ACM_save (M, path));
+  assert (!ACM_load_mapped (char, path));       // The file holds symbols of type wchar_t.
+  ACMachine (wchar_t) * P = ACM_load_mapped (wchar_t, path, alphaeq);
+  assert (P && ACM_nb_keywords (P) == ACM_nb_keywords (M));
+  const ACState (wchar_t) * p = ACM_reset (P);
+
   // 7. Initialize a state with `ACM_reset (machine)`
   state = ACM_reset (M);
   // 8. Inject symbols of the text, one at a time by calling `ACM_match (state, symbol)`.
   ACM_match (state, L' ');
+  ACM_match (p, L' ');
   // `ACM_nb_keywords (machine)` yields the number of registered keywords.
   printf ("[%zu] keywords registered.\n", ACM_nb_keywords (M));
 
@@ -304,12 +554,22 @@ main (void)
     exit (EXIT_FAILURE);
 
   myclock = clock ();
+  size_t book_length = 0, book_size = 0;
+  wchar_t *book = 0;
   for (wint_t wc; (wc = fgetwc (stream)) != WEOF;)
   {
+    if (book_length == book_size)
+    {
+      book = realloc (book, sizeof (*book) * (book_size = 2 * book_size + 1024));
+      assert (book);
+    }
+    book[book_length++] = wc;
     // 8. Inject symbols of the text, one at a time by calling `ACM_match (state, symbol)`.
     // 9. After each insertion of a symbol, check the returned value to know if the last inserted symbols match at least one keyword.
     size_t nb = ACM_match (state, wc);
 
+    size_t nb_mapped = ACM_match (p, wc);
+    assert (nb_mapped == nb);
     if (nb)
     {
       for (size_t j = 0; j < nb; j++)
@@ -318,7 +578,9 @@ main (void)
 
         // 10. If matches were found, retrieve them calling `ACM_get_match ()` for each match.
         //     An optional fourth argument will point to the pointer to the value associated with the matching keyword.
-        ACM_get_match (state, j, 0, &v);
+        size_t rank = ACM_get_match (state, j, 0, &v);
+        size_t rank_mapped = ACM_get_match (p, j);
+        assert (rank == rank_mapped);
         // Increment the value associated to the keyword.
         (*(size_t *) v)++;
       }
@@ -328,6 +590,35 @@ main (void)
   printf ("\n");
 
   fclose (stream);
+  ACM_release (P);
+  unlink (path);
+
+  // W counts the same occurrences of whole words as M.
+  // The end of the text is a word boundary for W, but not for M, which needs a separator after each word.
+  while (book_length && iswalpha (book[book_length - 1]))
+    book_length--;
+  assert (ACM_nb_keywords (W) == ACM_nb_keywords (M));
+  word_counts = calloc (ACM_nb_keywords (W), sizeof (*word_counts));
+  assert (word_counts);
+  const ACState (wchar_t) * w = ACM_reset (W);
+  ACM_match_records (w, book, book_length, count_word, 0, 0, ACM_MATCH_WORDS);
+  ACM_foreach_keyword (M, check_word_count);
+  // The same whole words are found when the book is parsed in chunks of a stream, the words overlapping the chunks.
+  size_t chunk_lengths[] = { 1, 7 };
+  for (size_t c = 0; c < sizeof (chunk_lengths) / sizeof (*chunk_lengths); c++)
+  {
+    memset (word_counts, 0, ACM_nb_keywords (W) * sizeof (*word_counts));
+    MatchStream (wchar_t) stream = { 0 };
+    w = ACM_reset (W);
+    for (size_t offset = 0; offset < book_length; offset += chunk_lengths[c])
+      ACM_match_records (w, book + offset, book_length - offset < chunk_lengths[c] ? book_length - offset : chunk_lengths[c],
+                         count_word, 0, offset, ACM_MATCH_WORDS, &stream);
+    ACM_end_records (w, count_word, 0, &stream);
+    ACM_foreach_keyword (M, check_word_count);
+  }
+  free (word_counts);
+  free (book);
+  ACM_release (W);
 
   // `ACM_foreach_keyword (machine, function)` applies a function (`void (*function) (Keyword (T), void *)`) on each registerd keyword.
   // Display keywords and their associated value.
@@ -338,4 +629,717 @@ main (void)
   // 12. After usage, release the state machine calling ACM_release() on M.
   //     ACM_release also frees the values associated to registered keywords.
   ACM_release (M);
+
+  /****************** Third test ************************/
+  // This test checks that a compiled machine (ACM_compile), and a machine with sorted symbols (thanks to an ordering operator),
+  // find the same matches as the machine they are built from.
+  {
+    char *keywords[] = { "buckle", "shoe", "knock", "door", "pick", "sticks", "ten", "o", "on", "ne" };
+    char BuckleMyShoe[] =
+      "One, two buckle my shoe\nThree, four knock on the door\nFive, six pick up sticks\nNine, ten a big fat hen...\n";
+    ACMachine (char) * C = ACM_create (char, nocaseeqchar);
+    ACMachine (char) * N = ACM_create (char, nocaseeqchar);
+    ACMachine (char) * S = ACM_create (char, nocaseeqchar, nocaseltchar);
+    Keyword (char) kws[sizeof (keywords) / sizeof (*keywords)];
+    for (size_t i = 0; i < sizeof (keywords) / sizeof (*keywords); i++)
+    {
+      ACM_KEYWORD_SET (kws[i], keywords[i], strlen (keywords[i]));
+      ACM_register_keyword (C, kws[i]);
+      ACM_register_keyword (S, kws[i]);
+    }
+    // All keywords are registered at once in N.
+    assert (ACM_register_keywords (N, kws, sizeof (kws) / sizeof (*kws)) == sizeof (kws) / sizeof (*kws));
+    assert (ACM_nb_keywords (N) == ACM_nb_keywords (C));
+    assert (ACM_compile (C));
+    M = ACM_create (wchar_t, nocaseeq);
+    assert (!ACM_compile (M));      // Symbols larger than one byte are compiled with the default equality operator only.
+    ACM_release (M);
+
+    // The keywords of C are pooled: the keywords already registered are copied to the pool, "big fat" will be appended to it.
+    assert (ACM_pool_keywords (C));
+    MatchHolder (char) match;
+    ACM_MATCH_INIT (match);
+
+    // The compiled table is discarded by ACM_register_keyword, and rebuilt by ACM_compile.
+    // S is frozen by ACM_build in the last pass, and then matches on its flat representation.
+    for (int pass = 0; pass < 3; pass++)
+    {
+      if (pass == 1)
+      {
+        Keyword (char) k;
+        ACM_KEYWORD_SET (k, "big fat", 7);
+        ACM_register_keyword (C, k);
+        ACM_register_keyword (N, k);
+        ACM_register_keyword (S, k);
+      }
+      else if (pass == 2)
+      {
+        ACM_compile (C);
+        ACM_build (S);
+      }
+      const ACState (char) * c = ACM_reset (C);
+      const ACState (char) * n = ACM_reset (N);
+      const ACState (char) * s = ACM_reset (S);
+      size_t total = 0;
+      for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+      {
+        size_t nb = ACM_match (c, BuckleMyShoe[i]);
+        assert (nb == ACM_match (n, BuckleMyShoe[i]));
+        assert (nb == ACM_match (s, BuckleMyShoe[i]));
+        for (size_t j = 0; j < nb; j++)
+        {
+          assert (ACM_get_match (c, j) == ACM_get_match (n, j));
+          assert (ACM_get_match (s, j) == ACM_get_match (n, j));
+          // A view of a pooled keyword has the symbols copied by ACM_get_match.
+          MatchView (char) view;
+          assert (ACM_get_match_view (c, j, &view) == ACM_get_match (n, j, &match));
+          assert (ACM_MATCH_LENGTH (view) == ACM_MATCH_LENGTH (match));
+          assert (!memcmp (ACM_MATCH_SYMBOLS (view), ACM_MATCH_SYMBOLS (match), ACM_MATCH_LENGTH (match)));
+          assert (ACM_get_match_view (n, j, &view) == ACM_MATCH_UID (match) && !ACM_MATCH_SYMBOLS (view));
+        }
+        current_pos = 0;
+        assert (ACM_foreach_match (c, check_match, &c) == nb);
+        total += nb;
+      }
+      // ACM_match_buffer parses the whole text at once.
+      c = ACM_reset (C);
+      n = ACM_reset (N);
+      s = ACM_reset (S);
+      assert (ACM_match_buffer (c, BuckleMyShoe, strlen (BuckleMyShoe)) == total);
+      assert (ACM_match_buffer (n, BuckleMyShoe, strlen (BuckleMyShoe)) == total);
+      assert (ACM_match_buffer (s, BuckleMyShoe, strlen (BuckleMyShoe)) == total);
+      // ACM_match_parallel reports the same matches at the same positions, whatever the number of threads.
+      size_t positions = 0;
+      n = ACM_reset (N);
+      ACM_match_buffer (n, BuckleMyShoe, strlen (BuckleMyShoe), sum_positions, &positions);
+      for (size_t nb_threads = 1; nb_threads <= 8; nb_threads++)
+      {
+        size_t sums[3] = { 0 };
+        assert (ACM_match_parallel (C, BuckleMyShoe, strlen (BuckleMyShoe), nb_threads, sum_positions, sums) == total);
+        assert (ACM_match_parallel (N, BuckleMyShoe, strlen (BuckleMyShoe), nb_threads, sum_positions, sums + 1) == total);
+        assert (ACM_match_parallel (S, BuckleMyShoe, strlen (BuckleMyShoe), nb_threads, sum_positions, sums + 2) == total);
+        assert (sums[0] == positions && sums[1] == positions && sums[2] == positions);
+      }
+      // ACM_match_records locates each match in the text, whether the text is parsed at once or in chunks.
+      const ACState (char) * states[] = { ACM_reset (C), ACM_reset (N), ACM_reset (S) };
+      for (size_t m = 0; m < sizeof (states) / sizeof (*states); m++)
+      {
+        struct match_records all = { 0 }, chunks = { 0 };
+        assert (ACM_match_records (states[m], BuckleMyShoe, strlen (BuckleMyShoe), add_record, &all) == total);
+        assert (all.nb_records == total);
+        states[m] = ACM_reset (m == 0 ? C : m == 1 ? N : S);
+        size_t half = strlen (BuckleMyShoe) / 2;
+        size_t nb = ACM_match_records (states[m], BuckleMyShoe, half, add_record, &chunks);
+        nb += ACM_match_records (states[m], BuckleMyShoe + half, strlen (BuckleMyShoe) - half, add_record, &chunks, half);
+        assert (nb == total && chunks.nb_records == total);
+        for (size_t r = 0; r < total; r++)
+        {
+          assert (all.records[r].start == chunks.records[r].start && all.records[r].end == chunks.records[r].end);
+          assert (all.records[r].rank == chunks.records[r].rank);
+          Keyword (char) k;
+          ACM_KEYWORD_SET (k, BuckleMyShoe + all.records[r].start, all.records[r].end - all.records[r].start);
+          assert (ACM_is_registered_keyword (m == 0 ? C : m == 1 ? N : S, k));
+        }
+        // The leftmost modes report the non-overlapping matches found by brute force.
+        char *registered[sizeof (keywords) / sizeof (*keywords) + 1];
+        memcpy (registered, keywords, sizeof (keywords));
+        registered[sizeof (keywords) / sizeof (*keywords)] = "big fat";
+        size_t nb_registered = sizeof (keywords) / sizeof (*keywords) + (pass > 0);
+        int modes[] = { ACM_MATCH_LEFTMOST_LONGEST, ACM_MATCH_LEFTMOST_FIRST };
+        for (size_t mode = 0; mode < sizeof (modes) / sizeof (*modes); mode++)
+        {
+          MatchRecord (char) expected[64];
+          size_t nb_expected = leftmost_matches (BuckleMyShoe, registered, nb_registered, modes[mode], expected);
+          struct match_records leftmost = { 0 };
+          states[m] = ACM_reset (m == 0 ? C : m == 1 ? N : S);
+          assert (ACM_match_records (states[m], BuckleMyShoe, strlen (BuckleMyShoe), add_record, &leftmost, 0, modes[mode]) ==
+                  nb_expected);
+          assert (leftmost.nb_records == nb_expected && nb_expected < total);
+          for (size_t r = 0; r < nb_expected; r++)
+            assert (leftmost.records[r].start == expected[r].start && leftmost.records[r].end == expected[r].end &&
+                    leftmost.records[r].rank == expected[r].rank);
+          // The same matches are reported when the text is parsed in chunks of a stream, whatever their length.
+          size_t chunk_lengths[] = { 1, 3, half };
+          for (size_t c = 0; c < sizeof (chunk_lengths) / sizeof (*chunk_lengths); c++)
+          {
+            struct match_records streamed = { 0 };
+            MatchStream (char) stream = { 0 };
+            states[m] = ACM_reset (m == 0 ? C : m == 1 ? N : S);
+            size_t nb_streamed = 0;
+            for (size_t offset = 0; offset < strlen (BuckleMyShoe); offset += chunk_lengths[c])
+            {
+              size_t chunk_length = strlen (BuckleMyShoe) - offset;
+              if (chunk_length > chunk_lengths[c])
+                chunk_length = chunk_lengths[c];
+              nb_streamed += ACM_match_records (states[m], BuckleMyShoe + offset, chunk_length, add_record, &streamed, offset,
+                                                modes[mode], &stream);
+            }
+            nb_streamed += ACM_end_records (states[m], add_record, &streamed, &stream);
+            assert (nb_streamed == nb_expected && streamed.nb_records == nb_expected);
+            for (size_t r = 0; r < nb_expected; r++)
+              assert (streamed.records[r].start == expected[r].start && streamed.records[r].end == expected[r].end &&
+                      streamed.records[r].rank == expected[r].rank);
+          }
+        }
+      }
+    }
+
+    // A match found in a text of a stream is resolved against the matches of the next texts:
+    // "abcd" is reported rather than "ab", although the first text ends after "ab".
+    {
+      ACMachine (char) * A = ACM_create (char);
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "ab", 2);
+      ACM_register_keyword (A, k);
+      ACM_KEYWORD_SET (k, "abcd", 4);
+      ACM_register_keyword (A, k);
+      const ACState (char) * a = ACM_reset (A);
+      struct match_records streamed = { 0 };
+      MatchStream (char) stream = { 0 };
+      size_t nb = ACM_match_records (a, "ab", 2, add_record, &streamed, 0, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+      nb += ACM_match_records (a, "cd", 2, add_record, &streamed, 2, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+      nb += ACM_end_records (a, add_record, &streamed, &stream);
+      assert (nb == 1 && streamed.nb_records == 1 && streamed.records[0].start == 0 && streamed.records[0].end == 4);
+      ACM_release (A);
+    }
+
+    // Keywords registered during the search of a stream are matched in its next texts, even longer than the previous ones:
+    // "a", then "bbbbb" and "aba", in "x" then "abbaba".
+    {
+      ACMachine (char) * A = ACM_create (char);
+      const ACState (char) * a = ACM_reset (A);
+      struct match_records streamed = { 0 };
+      MatchStream (char) stream = { 0 };
+      size_t nb = ACM_match_records (a, "x", 1, add_record, &streamed, 0, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "a", 1);
+      ACM_register_keyword (A, k);
+      nb += ACM_match_records (a, "a", 1, add_record, &streamed, 1, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+      ACM_KEYWORD_SET (k, "bbbbb", 5);
+      ACM_register_keyword (A, k);
+      ACM_KEYWORD_SET (k, "aba", 3);
+      ACM_register_keyword (A, k);
+      nb += ACM_match_records (a, "abbaba", 6, add_record, &streamed, 2, ACM_MATCH_LEFTMOST_LONGEST, &stream);
+      nb += ACM_end_records (a, add_record, &streamed, &stream);
+      assert (nb == 3 && streamed.nb_records == 3);
+      assert (streamed.records[0].start == 1 && streamed.records[0].end == 2);
+      assert (streamed.records[1].start == 2 && streamed.records[1].end == 3);
+      assert (streamed.records[2].start == 5 && streamed.records[2].end == 8);
+      ACM_release (A);
+    }
+
+    // The boundaries of whole words are checked on the symbols of the stream around them, whichever texts they lie in:
+    // in "a cats cat scat cat", the second and the last "cat" only are whole words.
+    {
+      SET_WORD_OPERATOR (char, alphachar);
+      ACMachine (char) * A = ACM_create (char);
+      SET_WORD_OPERATOR (char, 0);
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "cat", 3);
+      ACM_register_keyword (A, k);
+      const char *texts[] = { "a cat", "s", " ca", "t", " s", "cat", " c", "at" };
+      int modes[] = { ACM_MATCH_ALL, ACM_MATCH_LEFTMOST_LONGEST, ACM_MATCH_LEFTMOST_FIRST };
+      for (size_t mode = 0; mode < sizeof (modes) / sizeof (*modes); mode++)
+      {
+        const ACState (char) * a = ACM_reset (A);
+        struct match_records streamed = { 0 };
+        MatchStream (char) stream = { 0 };
+        size_t nb = 0, offset = 0;
+        for (size_t t = 0; t < sizeof (texts) / sizeof (*texts); offset += strlen (texts[t++]))
+          nb += ACM_match_records (a, texts[t], strlen (texts[t]), add_record, &streamed, offset, modes[mode] | ACM_MATCH_WORDS, &stream);
+        nb += ACM_end_records (a, add_record, &streamed, &stream);
+        assert (nb == 2 && streamed.nb_records == 2);
+        assert (streamed.records[0].start == 7 && streamed.records[0].end == 10);
+        assert (streamed.records[1].start == 16 && streamed.records[1].end == 19);
+      }
+      ACM_release (A);
+      // The word symbols of the previous texts are kept for the keywords registered during the search of the stream:
+      // "ab" is registered after " " (or "x") was searched, and then found in " ab " (but not in "xab ").
+      const char *firsts[] = { " ", "x" };
+      for (size_t f = 0; f < sizeof (firsts) / sizeof (*firsts); f++)
+      {
+        SET_WORD_OPERATOR (char, alphachar);
+        A = ACM_create (char);
+        SET_WORD_OPERATOR (char, 0);
+        const ACState (char) * a = ACM_reset (A);
+        struct match_records streamed = { 0 };
+        MatchStream (char) stream = { 0 };
+        size_t nb = ACM_match_records (a, firsts[f], 1, add_record, &streamed, 0, ACM_MATCH_WORDS, &stream);
+        ACM_KEYWORD_SET (k, "ab", 2);
+        ACM_register_keyword (A, k);
+        nb += ACM_match_records (a, "a", 1, add_record, &streamed, 1, ACM_MATCH_WORDS, &stream);
+        nb += ACM_match_records (a, "b ", 2, add_record, &streamed, 2, ACM_MATCH_WORDS, &stream);
+        nb += ACM_end_records (a, add_record, &streamed, &stream);
+        assert (nb == streamed.nb_records && nb == (f == 0));
+        assert (f || (streamed.records[0].start == 1 && streamed.records[0].end == 3));
+        ACM_release (A);
+      }
+    }
+
+    ACM_MATCH_RELEASE (match);
+
+    // Frozen machines, compiled (C) or not (S), are saved to a file, and loaded back by mapping the file in memory.
+    // The pool of keywords of C is saved with it.
+    {
+      char path[] = "/tmp/aho_corasick_template_test_XXXXXX";
+      int fd = mkstemp (path);
+      assert (fd >= 0);
+      close (fd);
+      assert (!ACM_save (N, path));     // N is not frozen.
+      ACM_build (C);
+      ACMachine (char) * machines[] = { C, S };
+      for (size_t m = 0; m < sizeof (machines) / sizeof (*machines); m++)
+      {
+        assert (ACM_save (machines[m], path));
+        // The ordering operator is ignored if the saved transitions were not sorted (C).
+        ACMachine (char) * L = ACM_load_mapped (char, path, nocaseeqchar, nocaseltchar);
+        assert (L && ACM_nb_keywords (L) == ACM_nb_keywords (machines[m]));
+        assert (ACM_pool_keywords (L) == (machines[m] == C));
+        const ACState (char) * a = ACM_reset (machines[m]);
+        const ACState (char) * l = ACM_reset (L);
+        MatchHolder (char) ma, ml;
+        ACM_MATCH_INIT (ma);
+        ACM_MATCH_INIT (ml);
+        size_t total = 0;
+        for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+        {
+          size_t nb = ACM_match (a, BuckleMyShoe[i]);
+          assert (ACM_match (l, BuckleMyShoe[i]) == nb);
+          for (size_t j = 0; j < nb; j++)
+          {
+            assert (ACM_get_match (a, j, &ma) == ACM_get_match (l, j, &ml));
+            assert (ACM_MATCH_LENGTH (ma) == ACM_MATCH_LENGTH (ml));
+            assert (!memcmp (ACM_MATCH_SYMBOLS (ma), ACM_MATCH_SYMBOLS (ml), ACM_MATCH_LENGTH (ma)));
+            MatchView (char) view;
+            assert (ACM_get_match_view (l, j, &view) == ACM_MATCH_UID (ml));
+            assert (ACM_MATCH_LENGTH (view) == ACM_MATCH_LENGTH (ml));
+            assert (ACM_pool_keywords (L) ? !memcmp (ACM_MATCH_SYMBOLS (view), ACM_MATCH_SYMBOLS (ml), ACM_MATCH_LENGTH (ml)) :
+                    !ACM_MATCH_SYMBOLS (view));
+          }
+          total += nb;
+        }
+        ACM_MATCH_RELEASE (ma);
+        ACM_MATCH_RELEASE (ml);
+        l = ACM_reset (L);
+        assert (ACM_match_buffer (l, BuckleMyShoe, strlen (BuckleMyShoe)) == total);
+        assert (ACM_match_parallel (L, BuckleMyShoe, strlen (BuckleMyShoe), 4) == total);
+        Keyword (char) k;
+        ACM_KEYWORD_SET (k, "Big Fat", 7);
+        assert (ACM_is_registered_keyword (L, k));
+        ACM_KEYWORD_SET (k, "big", 3);
+        assert (!ACM_is_registered_keyword (L, k));
+        assert (!ACM_register_keyword (L, k));    // A mapped machine is frozen.
+        // A mapped machine can be saved again.
+        assert (ACM_save (L, path));
+        ACM_release (L);
+        L = ACM_load_mapped (char, path, nocaseeqchar);
+        assert (L && ACM_nb_keywords (L) == ACM_nb_keywords (machines[m]));
+        l = ACM_reset (L);
+        assert (ACM_match_buffer (l, BuckleMyShoe, strlen (BuckleMyShoe)) == total);
+        ACM_release (L);
+        // A corrupted file is rejected at load, rather than read out of bounds by the searches:
+        // a transition to a state out of range, or a state failing to itself.
+        struct _ac_file_header header = read_file_header (path);
+        corrupt_file (path, header.edge_target, 0, header.nb_states);
+        assert (!ACM_load_mapped (char, path, nocaseeqchar));
+        assert (ACM_save (machines[m], path));
+        corrupt_file (path, header.hot, 4 * 1 + 2, 1);
+        assert (!ACM_load_mapped (char, path, nocaseeqchar));
+      }
+      unlink (path);
+    }
+
+    // A machine with a normalizer finds the same matches as the machine with the case insensitive equality operator (C).
+    {
+      SET_NORMALIZER (char, lowerchar);
+      ACMachine (char) * L = ACM_create (char);
+      SET_NORMALIZER (char, 0);
+      for (size_t i = 0; i < sizeof (kws) / sizeof (*kws); i++)
+        ACM_register_keyword (L, kws[i]);
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "BIG FAT", 7);    // Registered as "big fat"
+      ACM_register_keyword (L, k);
+      ACM_KEYWORD_SET (k, "Big Fat", 7);
+      assert (ACM_is_registered_keyword (L, k));
+      for (int pass = 0; pass < 3; pass++)
+      {
+        if (pass == 1)
+          assert (ACM_compile (L));
+        else if (pass == 2)
+          ACM_build (L);
+        const ACState (char) * c = ACM_reset (C);
+        const ACState (char) * l = ACM_reset (L);
+        for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+        {
+          size_t nb = ACM_match (c, BuckleMyShoe[i]);
+          assert (ACM_match (l, BuckleMyShoe[i]) == nb);
+          for (size_t j = 0; j < nb; j++)
+            assert (ACM_get_match (c, j) == ACM_get_match (l, j));
+        }
+        l = ACM_reset (L);
+        c = ACM_reset (C);
+        assert (ACM_match_buffer (l, BuckleMyShoe, strlen (BuckleMyShoe)) ==
+                ACM_match_buffer (c, BuckleMyShoe, strlen (BuckleMyShoe)));
+      }
+      // The file of a machine with a normalizer is only loaded with the normalizer of its keywords.
+      char path[] = "/tmp/aho_corasick_template_test_XXXXXX";
+      int fd = mkstemp (path);
+      assert (fd >= 0);
+      close (fd);
+      assert (ACM_save (L, path));
+      assert (!ACM_load_mapped (char, path));
+      SET_NORMALIZER (char, lowerchar);
+      ACMachine (char) * P = ACM_load_mapped (char, path);
+      SET_NORMALIZER (char, 0);
+      assert (P);
+      const ACState (char) * p = ACM_reset (P);
+      const ACState (char) * c = ACM_reset (C);
+      assert (ACM_match_buffer (p, BuckleMyShoe, strlen (BuckleMyShoe)) ==
+              ACM_match_buffer (c, BuckleMyShoe, strlen (BuckleMyShoe)));
+      ACM_release (P);
+      unlink (path);
+      ACM_release (L);
+    }
+
+    // Symbols larger than one byte are compiled on the alphabet of the keywords, with the default equality operator.
+    {
+      SET_EQ_OPERATOR (wchar_t, 0);
+      SET_NORMALIZER (wchar_t, lowerwchar);
+      ACMachine (wchar_t) * W = ACM_create (wchar_t);
+      SET_NORMALIZER (wchar_t, 0);
+      wchar_t letters[20];
+      Keyword (wchar_t) k;
+      for (size_t i = 0; i <= sizeof (kws) / sizeof (*kws); i++)
+      {
+        const char *keyword = i < sizeof (kws) / sizeof (*kws) ? keywords[i] : "Big Fat";
+        for (size_t j = 0; j < strlen (keyword); j++)
+          letters[j] = (unsigned char) keyword[j];
+        ACM_KEYWORD_SET (k, letters, strlen (keyword));
+        ACM_register_keyword (W, k);
+      }
+      assert (ACM_compile (W));
+      wchar_t text[sizeof (BuckleMyShoe)];
+      for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+        text[i] = (unsigned char) BuckleMyShoe[i];
+      const ACState (char) * c = ACM_reset (C);
+      const ACState (wchar_t) * w = ACM_reset (W);
+      size_t total = 0;
+      for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+      {
+        size_t nb = ACM_match (c, BuckleMyShoe[i]);
+        assert (ACM_match (w, text[i]) == nb);
+        for (size_t j = 0; j < nb; j++)
+          assert (ACM_get_match (c, j) == ACM_get_match (w, j));
+        total += nb;
+      }
+      w = ACM_reset (W);
+      assert (ACM_match_buffer (w, text, strlen (BuckleMyShoe)) == total);
+      ACM_release (W);
+      SET_EQ_OPERATOR (wchar_t, nocaseeq);
+    }
+
+    // States followed by many symbols are searched through a hash table, with the default hash operator,
+    // transitions being sorted (O) or not (H), or with a user defined hash operator (U, see SET_HASH_OPERATOR).
+    // They are compared with a machine R searched linearly, with a user defined equality operator and no hash operator.
+    {
+      SET_EQ_OPERATOR (wchar_t, 0);
+      ACMachine (wchar_t) * R = ACM_create (wchar_t, wchareq);
+      ACMachine (wchar_t) * H = ACM_create (wchar_t);
+      ACMachine (wchar_t) * O = ACM_create (wchar_t, 0, wcharlt);
+      SET_HASH_OPERATOR (wchar_t, wcharhash);
+      ACMachine (wchar_t) * U = ACM_create (wchar_t, wchareq);
+      SET_HASH_OPERATOR (wchar_t, 0);
+      ACMachine (wchar_t) * machines[] = { R, H, O, U };
+      size_t nb_machines = sizeof (machines) / sizeof (*machines);
+      wchar_t letters[2];
+      Keyword (wchar_t) k;
+      ACM_KEYWORD_SET (k, letters, 2);
+      // Keywords of two symbols among 40, registered in no particular order:
+      // 40 transitions from state 0, and 20 from each state of depth 1.
+      for (size_t i = 0; i < 40; i++)
+        for (size_t j = 0; j < 40; j++)
+          if ((7 * i + 13 * j) % 2 == 0)
+          {
+            letters[0] = 0x100 + 7 * i % 40;
+            letters[1] = 0x100 + 13 * j % 40;
+            for (size_t m = 0; m < nb_machines; m++)
+              assert (ACM_register_keyword (machines[m], k));
+          }
+      // The text also holds symbols which are in no keyword.
+      wchar_t text[4000];
+      unsigned long x = 1;
+      for (size_t i = 0; i < sizeof (text) / sizeof (*text); i++)
+      {
+        x = x * 1103515245 + 12345;
+        text[i] = 0x100 + (x >> 16) % 44;
+      }
+      size_t length = sizeof (text) / sizeof (*text);
+      for (int pass = 0; pass < 4; pass++)
+      {
+        if (pass == 1)
+          // Some states lose their hash table, or all their transitions, and the hash tables of the others are rebuilt.
+          for (wchar_t a = 0; a < 40; a += 3)
+            for (wchar_t b = 0; b < 40; b += a % 2 ? 3 : 1)
+            {
+              letters[0] = 0x100 + a;
+              letters[1] = 0x100 + b;
+              int registered = ACM_unregister_keyword (R, k);
+              for (size_t m = 1; m < nb_machines; m++)
+                assert (ACM_unregister_keyword (machines[m], k) == registered);
+            }
+        else if (pass == 2)
+        {
+          assert (!ACM_compile (R));
+          for (size_t m = 1; m < nb_machines; m++)
+            assert (ACM_compile (machines[m]));
+        }
+        else if (pass == 3)
+          for (size_t m = 0; m < nb_machines; m++)
+            ACM_build (machines[m]);
+        const ACState (wchar_t) * states[sizeof (machines) / sizeof (*machines)];
+        for (size_t m = 0; m < nb_machines; m++)
+          states[m] = ACM_reset (machines[m]);
+        size_t total = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+          size_t nb = ACM_match (states[0], text[i]);
+          for (size_t m = 1; m < nb_machines; m++)
+          {
+            assert (ACM_match (states[m], text[i]) == nb);
+            for (size_t j = 0; j < nb; j++)
+              assert (ACM_get_match (states[m], j) == ACM_get_match (states[0], j));
+          }
+          total += nb;
+        }
+        assert (total);
+        for (size_t m = 0; m < nb_machines; m++)
+        {
+          states[m] = ACM_reset (machines[m]);
+          assert (ACM_match_buffer (states[m], text, length) == total);
+        }
+        if (pass < 3)
+          continue;
+        // The hash tables are saved with the machine, and used by the loaded machine with the same hash operator only.
+        char path[] = "/tmp/aho_corasick_template_test_XXXXXX";
+        int fd = mkstemp (path);
+        assert (fd >= 0);
+        close (fd);
+        for (size_t m = 1; m < nb_machines; m++)
+        {
+          assert (ACM_save (machines[m], path));
+          // A file whose hash tables were built with a user defined hash operator (U) is only loaded with a hash operator.
+          if (machines[m] == U)
+          {
+            assert (!ACM_load_mapped (wchar_t, path));
+            SET_HASH_OPERATOR (wchar_t, wcharhash);
+          }
+          else
+          {
+            SET_HASH_OPERATOR (wchar_t, wcharhash);
+            assert (!ACM_load_mapped (wchar_t, path));
+            SET_HASH_OPERATOR (wchar_t, 0);
+          }
+          ACMachine (wchar_t) * L = ACM_load_mapped (wchar_t, path);
+          SET_HASH_OPERATOR (wchar_t, 0);
+          assert (L);
+          const ACState (wchar_t) * l = ACM_reset (L);
+          assert (ACM_match_buffer (l, text, length) == total);
+          ACM_release (L);
+          // The snapshots use the hash tables as well.
+          assert (ACM_publish (machines[m]));
+          const ACMachine (wchar_t) * S = ACM_snapshot (machines[m]);
+          const ACState (wchar_t) * s = ACM_reset (S);
+          assert (ACM_match_buffer (s, text, length) == total);
+          ACM_release (S);
+        }
+        unlink (path);
+      }
+      for (size_t m = 0; m < nb_machines; m++)
+        ACM_release (machines[m]);
+      SET_EQ_OPERATOR (wchar_t, nocaseeq);
+    }
+
+    // Phrases of words are searched by a machine of the ids of the words, interned in a table.
+    {
+      const char *phrases[] = { "buckle my shoe", "knock on the door", "on the", "the door", "pick up sticks",
+        "big fat hen", "fat cat"
+      };
+      ACMIntern *I = ACM_intern_create ();
+      ACMachine (size_t) * P = ACM_create (size_t);
+      char line[sizeof (BuckleMyShoe)];
+      size_t ids[sizeof (BuckleMyShoe)];
+      Keyword (size_t) k;
+      for (size_t i = 0; i < sizeof (phrases) / sizeof (*phrases); i++)
+      {
+        size_t length = 0;
+        strcpy (line, phrases[i]);
+        for (char *token = strtok (line, " "); token; token = strtok (0, " "))
+          ids[length++] = ACM_intern (I, token);
+        ACM_KEYWORD_SET (k, ids, length);
+        assert (ACM_register_keyword (P, k));
+      }
+      assert (ACM_intern (I, "the") == ACM_intern_find (I, "the"));
+      assert (!strcmp (ACM_intern_string (I, ACM_intern_find (I, "fat")), "fat"));
+      assert (!ACM_intern_find (I, "two") && !ACM_intern_string (I, 0));
+      // The words of the text which are in no keyword have id 0.
+      size_t length = 0;
+      strcpy (line, BuckleMyShoe);
+      for (char *token = strtok (line, " ,.\n"); token; token = strtok (0, " ,.\n"))
+        ids[length++] = ACM_intern_find (I, token);
+      for (int pass = 0; pass < 2; pass++)
+      {
+        if (pass)
+          assert (ACM_compile (P));
+        const ACState (size_t) * p = ACM_reset (P);
+        size_t total = 0;
+        MatchHolder (size_t) match;
+        ACM_MATCH_INIT (match);
+        for (size_t i = 0; i < length; i++)
+        {
+          size_t nb = ACM_match (p, ids[i]);
+          for (size_t j = 0; j < nb; j++)
+          {
+            ACM_get_match (p, j, &match);
+            // The words of the matching phrase are retrieved from the table.
+            for (size_t w = 0; w < ACM_MATCH_LENGTH (match); w++)
+              assert (ACM_MATCH_SYMBOLS (match)[w] == ids[i + 1 - ACM_MATCH_LENGTH (match) + w] &&
+                      ACM_intern_string (I, ACM_MATCH_SYMBOLS (match)[w]));
+          }
+          total += nb;
+        }
+        ACM_MATCH_RELEASE (match);
+        assert (total == 6);
+      }
+      ACM_release (P);
+      ACM_intern_release (I);
+    }
+
+    // After a first match, the failure function is updated incrementally by ACM_register_keyword and ACM_unregister_keyword.
+    // N is compared with a machine R built from scratch with the same keywords.
+    {
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "o", 1);  // "o" is a prefix of "on"
+      assert (ACM_unregister_keyword (N, k));
+      ACM_KEYWORD_SET (k, "sticks", 6);
+      assert (ACM_unregister_keyword (N, k));
+      ACM_KEYWORD_SET (k, "ick", 3);
+      assert (ACM_register_keyword (N, k));
+      ACMachine (char) * R = ACM_create (char, nocaseeqchar);
+      for (size_t i = 0; i < sizeof (kws) / sizeof (*kws); i++)
+        if (strcmp (keywords[i], "o") && strcmp (keywords[i], "sticks"))
+          ACM_register_keyword (R, kws[i]);
+      ACM_KEYWORD_SET (k, "big fat", 7);
+      ACM_register_keyword (R, k);
+      ACM_KEYWORD_SET (k, "ick", 3);
+      ACM_register_keyword (R, k);
+      assert (ACM_nb_keywords (N) == ACM_nb_keywords (R));
+      const ACState (char) * n = ACM_reset (N);
+      const ACState (char) * r = ACM_reset (R);
+      for (size_t i = 0; i < strlen (BuckleMyShoe); i++)
+        assert (ACM_match (n, BuckleMyShoe[i]) == ACM_match (r, BuckleMyShoe[i]));
+      ACM_release (R);
+    }
+
+    // Snapshots published by ACM_publish are searched by readers while the keywords of the machine are updated.
+    {
+      ACMachine (char) * W = ACM_create (char, nocaseeqchar);
+      assert (ACM_pool_keywords (W));
+      struct snapshot_reader reader = {.machine = W,.text = BuckleMyShoe };
+      char *sets[2][3] = { {"buckle", "shoe", 0}, {"knock", "door", "ten"} };
+      pthread_t thread;
+      assert (!ACM_snapshot (W));
+      // The two sets of keywords replace each other in turn.
+      for (int round = 0; round < 200; round++)
+      {
+        Keyword (char) k;
+        for (size_t i = 0; i < 3; i++)
+          if (round && sets[(round + 1) % 2][i])
+          {
+            ACM_KEYWORD_SET (k, sets[(round + 1) % 2][i], strlen (sets[(round + 1) % 2][i]));
+            assert (ACM_unregister_keyword (W, k));
+          }
+        for (size_t i = 0; i < 3; i++)
+          if (sets[round % 2][i])
+          {
+            size_t *v = malloc (sizeof (*v));
+            *v = strlen (sets[round % 2][i]);
+            ACM_KEYWORD_SET (k, sets[round % 2][i], *v);
+            assert (ACM_register_keyword (W, k, v, free));
+          }
+        assert (ACM_publish (W));
+        if (round < 2)
+        {
+          const ACMachine (char) * S = ACM_snapshot (W);
+          const ACState (char) * s = ACM_reset (S);
+          reader.nb_matches[round] = ACM_match_buffer (s, BuckleMyShoe, strlen (BuckleMyShoe));
+          ACM_release (S);
+        }
+        else if (round == 2)
+          assert (!pthread_create (&thread, 0, read_snapshots, &reader));
+      }
+      assert (reader.nb_matches[0] != reader.nb_matches[1]);
+      __atomic_store_n (&reader.stop, 1, __ATOMIC_SEQ_CST);
+      assert (!pthread_join (thread, 0));
+      // A replaced snapshot is freed by the release of its last reader, without waiting for a later publication,
+      // and the values of the keywords unregistered meanwhile are destroyed with it.
+      Keyword (char) k;
+      ACM_KEYWORD_SET (k, "hen", 3);
+      assert (ACM_register_keyword (W, k, calloc (1, sizeof (size_t)), count_destroyed));
+      assert (ACM_publish (W));
+      const ACMachine (char) * S = ACM_snapshot (W);
+      assert (ACM_unregister_keyword (W, k));
+      assert (ACM_publish (W));
+      assert (!nb_destroyed);
+      ACM_release (S);
+      assert (nb_destroyed == 1);
+      ACM_release (W);
+    }
+
+    // With at most 3 symbols starting the keywords, ACM_match_buffer skips the text from state 0 up to the next of them
+    // (with memchr for "1984" and "1985", 16 bytes at a time otherwise), and finds the matches ACM_match finds one symbol after the other,
+    // whether the machine is a tree, compiled, frozen or a published snapshot.
+    {
+      char *years[] = { "1984", "1985", "2001" };
+      const char text[] = "In 1984, 19841985 years after 1 AD and 17 years before 2001: 1919841985, 2001, 200 1984";
+      for (size_t nb_years = 2; nb_years <= 3; nb_years++)
+        for (int kind = 0; kind < 4; kind++)
+        {
+          ACMachine (char) * Y = ACM_create (char);
+          for (size_t i = 0; i < nb_years; i++)
+          {
+            Keyword (char) k;
+            ACM_KEYWORD_SET (k, years[i], strlen (years[i]));
+            ACM_register_keyword (Y, k);
+          }
+          if (kind == 1)
+            assert (ACM_compile (Y));
+          else if (kind == 2)
+            ACM_build (Y);
+          else if (kind == 3)
+            assert (ACM_publish (Y));
+          const ACMachine (char) * R = kind == 3 ? ACM_snapshot (Y) : Y;
+          const ACState (char) * y = ACM_reset (R);
+          size_t total = 0, positions = 0;
+          for (size_t i = 0; i < strlen (text); i++)
+          {
+            size_t nb = ACM_match (y, text[i]);
+            total += nb;
+            positions += (i + 1) * nb;
+          }
+          assert (total == (nb_years == 2 ? 6 : 8));
+          size_t sum = 0;
+          y = ACM_reset (R);
+          assert (ACM_match_buffer (y, text, strlen (text), sum_positions, &sum) == total && sum == positions);
+          // The search goes on from one buffer to the next, in the middle of "19841985".
+          y = ACM_reset (R);
+          assert (ACM_match_buffer (y, text, 14) + ACM_match_buffer (y, text + 14, strlen (text) - 14) == total);
+          if (kind == 3)
+            ACM_release (R);
+          ACM_release (Y);
+        }
+    }
+    ACM_release (S);
+    ACM_release (N);
+    ACM_release (C);
+  }
 }